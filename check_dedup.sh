@@ -0,0 +1,29 @@
+#!/bin/bash
+# check_dedup.sh
+# Deduplicated transfers into a chunk store smaller than what they pin:
+# a file whose chunks fill the store, then one that repeats it and also
+# repeats a new run of its own, twice. Every copy must arrive intact.
+set -u
+port=18041
+dir=$(mktemp -d)
+trap 'kill $recv 2>/dev/null; rm -rf "$dir"' EXIT
+cd "$dir"
+head -c 1500000 /dev/urandom > a
+head -c 300000 /dev/urandom > r
+cat a r r r > b
+
+"$OLDPWD/recvfile" -p $port -k -C store -M 1 > recv.log 2>&1 &
+recv=$!
+sleep 0.5
+status=0
+for f in a b b; do
+    rm -f $f.recv
+    if ! "$OLDPWD/sendfile" -r 127.0.0.1:$port -f ./$f -D > send.log 2>&1 || ! cmp -s $f $f.recv; then
+        echo "FAIL $f"
+        tail -n 3 send.log recv.log
+        status=1
+    else
+        echo "ok $f: $(grep Dedup send.log)"
+    fi
+done
+exit $status
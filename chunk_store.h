@@ -0,0 +1,311 @@
+// chunk_store.h
+// Content-defined chunking and the receiver's content-addressed chunk
+// store. Chunk boundaries come from a gear rolling hash over the data
+// itself (FastCDC), so an insertion or deletion only changes the chunks
+// around it, and files that share regions share most of their chunks.
+// Chunks are named by the first 16 bytes of their SHA-256.
+#ifndef CHUNK_STORE_H
+#define CHUNK_STORE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include "frame_codec.h"
+
+#define MIN_CHUNK_SIZE (2 * 1024)
+#define AVG_CHUNK_SIZE (8 * 1024)
+#define MAX_CHUNK_SIZE (64 * 1024)
+#define CHUNK_READ_SIZE (1024 * 1024)  // File read per refill while chunking
+
+// FastCDC masks for an 8 KB average: 15 bits before the average size make a
+// cut unlikely, 11 bits after it make one likely, which narrows the spread
+// of chunk sizes around the average
+#define CHUNK_MASK_SMALL 0x0003590703530000ULL
+#define CHUNK_MASK_LARGE 0x0000d90003530000ULL
+
+struct ChunkHash {
+    unsigned char bytes[ManifestEntry::hash_size];
+
+    bool operator<(const ChunkHash &other) const { return memcmp(bytes, other.bytes, sizeof(bytes)) < 0; }
+    bool operator==(const ChunkHash &other) const { return memcmp(bytes, other.bytes, sizeof(bytes)) == 0; }
+
+    std::string hex() const {
+        static const char digits[] = "0123456789abcdef";
+        std::string out;
+        for (unsigned char byte : bytes) {
+            out += digits[byte >> 4];
+            out += digits[byte & 0xF];
+        }
+        return out;
+    }
+
+    bool parse_hex(const std::string &text) {
+        if (text.size() != 2 * sizeof(bytes)) {
+            return false;
+        }
+        for (size_t i = 0; i < sizeof(bytes); i++) {
+            unsigned int byte;
+            if (sscanf(text.c_str() + 2 * i, "%2x", &byte) != 1) {
+                return false;
+            }
+            bytes[i] = byte;
+        }
+        return true;
+    }
+};
+
+inline ChunkHash hash_chunk(const unsigned char *data, size_t size) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_size = 0;
+    EVP_Digest(data, size, digest, &digest_size, EVP_sha256(), nullptr);
+    ChunkHash hash;
+    memcpy(hash.bytes, digest, sizeof(hash.bytes));
+    return hash;
+}
+
+// Random but fixed per byte value, so every build cuts at the same places
+inline const uint64_t *gear_table() {
+    static const struct Table {
+        uint64_t values[256];
+        Table() {
+            uint64_t state = 0x9E3779B97F4A7C15ULL;
+            for (uint64_t &value : values) {
+                // splitmix64
+                uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+                value = z ^ (z >> 31);
+            }
+        }
+    } table;
+    return table.values;
+}
+
+// Length of the chunk that starts at data, with size bytes available
+inline size_t next_chunk(const unsigned char *data, size_t size) {
+    if (size <= MIN_CHUNK_SIZE) {
+        return size;
+    }
+    const uint64_t *gear = gear_table();
+    size_t limit = std::min<size_t>(size, MAX_CHUNK_SIZE);
+    size_t normal = std::min<size_t>(size, AVG_CHUNK_SIZE);
+    uint64_t hash = 0;
+    size_t i = MIN_CHUNK_SIZE;
+    for (; i < normal; i++) {
+        hash = (hash << 1) + gear[data[i]];
+        if (!(hash & CHUNK_MASK_SMALL)) {
+            return i + 1;
+        }
+    }
+    for (; i < limit; i++) {
+        hash = (hash << 1) + gear[data[i]];
+        if (!(hash & CHUNK_MASK_LARGE)) {
+            return i + 1;
+        }
+    }
+    return limit;
+}
+
+// A chunk of a file being sent
+struct FileChunk {
+    ChunkHash hash;
+    uint64_t offset;
+    uint32_t size;
+    bool needed = true;  // Until the receiver says it has it
+};
+
+// Cut a whole file into chunks; false on a read error
+inline bool chunk_file(int fd, std::vector<FileChunk> &chunks) {
+    std::vector<unsigned char> buffer(CHUNK_READ_SIZE + MAX_CHUNK_SIZE);
+    size_t start = 0, end = 0;
+    uint64_t offset = 0;
+    bool eof = false;
+    while (!eof || start < end) {
+        // Keep at least a maximal chunk ahead so cuts never depend on where a read ended
+        if (!eof && end - start < MAX_CHUNK_SIZE) {
+            memmove(buffer.data(), buffer.data() + start, end - start);
+            end -= start;
+            start = 0;
+            while (end < buffer.size()) {
+                ssize_t n = read(fd, buffer.data() + end, buffer.size() - end);
+                if (n < 0) {
+                    return false;
+                }
+                if (n == 0) {
+                    eof = true;
+                    break;
+                }
+                end += n;
+            }
+            continue;
+        }
+        FileChunk chunk;
+        chunk.size = next_chunk(buffer.data() + start, end - start);
+        chunk.offset = offset;
+        chunk.hash = hash_chunk(buffer.data() + start, chunk.size);
+        chunks.push_back(chunk);
+        start += chunk.size;
+        offset += chunk.size;
+    }
+    return true;
+}
+
+// Receiver's chunks, one file each in a directory, named by the hex hash.
+// Past the byte budget unpinned chunks are evicted, least recently used
+// first or, under FIFO, oldest stored first. A transfer pins the chunks it
+// was told we have until its file is complete. The directory outlives the
+// process and is indexed again on start-up, in the order of file mtimes.
+class ChunkStore {
+public:
+    ChunkStore(const std::string &dir, uint64_t max_bytes, bool lru) : dir_(dir), max_bytes_(max_bytes), lru_(lru) {
+        mkdir(dir.c_str(), 0700);
+        DIR *listing = opendir(dir.c_str());
+        if (!listing) {
+            perror("Failed to open chunk store");
+            exit(1);
+        }
+        std::vector<std::pair<struct timespec, ChunkHash>> found;
+        struct dirent *item;
+        while ((item = readdir(listing))) {
+            ChunkHash hash;
+            struct stat st;
+            if (!hash.parse_hex(item->d_name) || stat(path(hash).c_str(), &st) < 0) {
+                continue;
+            }
+            found.push_back(std::make_pair(st.st_mtim, hash));
+            entries_[hash].size = st.st_size;
+            bytes_ += st.st_size;
+        }
+        closedir(listing);
+        std::sort(found.begin(), found.end(), [](const std::pair<struct timespec, ChunkHash> &a, const std::pair<struct timespec, ChunkHash> &b) {
+            return a.first.tv_sec != b.first.tv_sec ? a.first.tv_sec < b.first.tv_sec : a.first.tv_nsec < b.first.tv_nsec;
+        });
+        for (auto &item : found) {
+            use(item.second);
+        }
+        evict();
+    }
+
+    size_t count() const { return entries_.size(); }
+    uint64_t bytes() const { return bytes_; }
+
+    // Pin a chunk we have; false if we don't
+    bool acquire(const ChunkHash &hash) {
+        auto it = entries_.find(hash);
+        if (it == entries_.end()) {
+            return false;
+        }
+        it->second.pins++;
+        if (lru_) {
+            use(hash);
+            utimensat(AT_FDCWD, path(hash).c_str(), nullptr, 0);
+        }
+        return true;
+    }
+
+    void release(const ChunkHash &hash) {
+        auto it = entries_.find(hash);
+        if (it != entries_.end() && it->second.pins > 0) {
+            it->second.pins--;
+        }
+        evict();
+    }
+
+    // Contents of a chunk; false if it cannot be read back in full, and
+    // then it is no longer offered
+    bool read(const ChunkHash &hash, std::vector<unsigned char> &data) {
+        auto it = entries_.find(hash);
+        if (it == entries_.end()) {
+            return false;
+        }
+        data.resize(it->second.size);
+        int fd = open(path(hash).c_str(), O_RDONLY);
+        ssize_t n = fd < 0 ? -1 : pread(fd, data.data(), data.size(), 0);
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (n != (ssize_t)data.size()) {
+            unlink(path(hash).c_str());
+            bytes_ -= it->second.size;
+            order_.erase(std::make_pair(it->second.tick, hash));
+            entries_.erase(it);
+            return false;
+        }
+        return true;
+    }
+
+    // Keep a chunk received in full, making room for it if need be
+    void put(const ChunkHash &hash, const unsigned char *data, size_t size) {
+        if (entries_.count(hash) || size > max_bytes_) {
+            return;
+        }
+        std::string final_path = path(hash), temp_path = final_path + ".tmp";
+        int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0) {
+            perror("Failed to store chunk");
+            return;
+        }
+        bool written = write(fd, data, size) == (ssize_t)size;
+        close(fd);
+        if (!written || rename(temp_path.c_str(), final_path.c_str()) < 0) {
+            perror("Failed to store chunk");
+            unlink(temp_path.c_str());
+            return;
+        }
+        entries_[hash].size = size;
+        bytes_ += size;
+        use(hash);
+        evict();
+    }
+
+private:
+    struct Entry {
+        uint64_t size = 0;
+        uint64_t tick = 0;  // Position in the eviction order
+        int pins = 0;
+    };
+
+    std::string path(const ChunkHash &hash) const { return dir_ + "/" + hash.hex(); }
+
+    // Move a chunk to the young end of the eviction order
+    void use(const ChunkHash &hash) {
+        Entry &entry = entries_[hash];
+        order_.erase(std::make_pair(entry.tick, hash));
+        entry.tick = ++clock_;
+        order_.insert(std::make_pair(entry.tick, hash));
+    }
+
+    void evict() {
+        for (auto it = order_.begin(); bytes_ > max_bytes_ && it != order_.end();) {
+            Entry &entry = entries_[it->second];
+            if (entry.pins > 0) {
+                ++it;
+                continue;
+            }
+            unlink(path(it->second).c_str());
+            bytes_ -= entry.size;
+            entries_.erase(it->second);
+            it = order_.erase(it);
+        }
+    }
+
+    std::string dir_;
+    uint64_t max_bytes_;
+    bool lru_;
+    uint64_t bytes_ = 0;
+    uint64_t clock_ = 0;
+    std::map<ChunkHash, Entry> entries_;
+    std::set<std::pair<uint64_t, ChunkHash>> order_;
+};
+
+#endif
@@ -10,40 +10,38 @@
 #include <fstream>      // For file handling
 #include <chrono>
 #include <fcntl.h>      // For fcntl()
-#include <sys/select.h> // For select()
+#include <cerrno>       // For errno
+#include "event_loop.h" // For EventLoop, Timer
+#include "frame_codec.h" // For Packet, FrameWriter, FrameReader
 
 using namespace std;
 
 #define PORT           18020
-#define MAXLINE        1024
 #define WINDOW_SIZE    5
 #define TIMEOUT_MS     1000
 
-struct Packet {
-    uint16_t seq_num;    // Sequence number
-    uint16_t ack_num;    // Acknowledgment number
-    uint16_t checksum;   // For error detection
-    uint16_t data_length;  // Length of data in the packet
+// One window slot: the encoded packet plus sender-only bookkeeping
+struct Slot {
+    unsigned char frame[Packet::max_size];
+    int size;
+    int seq;
+    bool acked;
     chrono::steady_clock::time_point send_time; // Time when the packet was sent
-    char data[MAXLINE];  // Data payload
 };
 
-uint16_t calculateChecksum(const Packet& packet) {
-    uint32_t checksum = 0;
-    checksum += ntohs(packet.seq_num);
-    checksum += ntohs(packet.ack_num);
-    checksum += ntohs(packet.data_length);
-    for (size_t i = 0; i < ntohs(packet.data_length); i++) {
-        checksum += static_cast<uint8_t>(packet.data[i]);
+// Send only the encoded bytes of one packet
+bool sendPacket(int sockfd, const unsigned char* frame, int size, struct sockaddr_in& servaddr) {
+    ssize_t bytes_sent = sendto(sockfd, frame, size, 0, (const struct sockaddr*)&servaddr, sizeof(servaddr));
+    if (bytes_sent == -1) {
+        perror("sendto failed");
+        return false;
     }
-    // Add carries
-    while (checksum >> 16) {
-        checksum = (checksum & 0xFFFF) + (checksum >> 16);
-    }
-    return static_cast<uint16_t>(~checksum);
+    return true;
 }
 
 // Function to send a file over UDP
+// Each window slot owns a retransmit timer on the event loop, so only the
+// packet whose deadline passed is resent and nothing is scanned per tick.
 void sendFile(const char* filePath, int sockfd, struct sockaddr_in& servaddr) {
     // Open the file
     ifstream file(filePath, ios::binary);
@@ -52,44 +50,50 @@ void sendFile(const char* filePath, int sockfd, struct sockaddr_in& servaddr) {
         exit(EXIT_FAILURE);
     }
 
-    Packet window[WINDOW_SIZE];
-    memset(window, 0, sizeof(window)); // Initialize window packets
-    char buffer[MAXLINE];
+    EventLoop loop;
+    Slot window[WINDOW_SIZE];
+    Timer timers[WINDOW_SIZE];     // Retransmit deadline per window slot
     int base = 0;   // The sequence number of the oldest unacknowledged packet
     int seq = 0;    // Next sequence number to use
     socklen_t len = sizeof(servaddr);
     bool doneReading = false;
-    auto now = chrono::steady_clock::now();
 
     // Set socket to non-blocking mode
     fcntl(sockfd, F_SETFL, O_NONBLOCK);
 
-    while (!doneReading || base < seq) {
-        // Send packets within window
+    for (int i = 0; i < WINDOW_SIZE; i++) {
+        timers[i].callback = [&, i]() {
+            Slot& slot = window[i];
+            slot.send_time = chrono::steady_clock::now();
+            if (sendPacket(sockfd, slot.frame, slot.size, servaddr)) {
+                cout << "Timeout, retransmitted packet seq: " << slot.seq << endl;
+            }
+            loop.arm(timers[i], TIMEOUT_MS);
+        };
+    }
+
+    // Send packets within window
+    auto fillWindow = [&]() {
         while (!doneReading && seq < base + WINDOW_SIZE) {
-            // Read a chunk of the file into the buffer
-            file.read(buffer, MAXLINE);
+            // Read a chunk of the file straight into the packet payload
+            Slot& slot = window[seq % WINDOW_SIZE];
+            FrameWriter<Packet> packet(slot.frame);
+            file.read((char*)packet.payload(), Packet::max_payload);
             streamsize bytesRead = file.gcount();
 
             if (bytesRead > 0) {
-                Packet& packet = window[seq % WINDOW_SIZE];
-                memset(&packet, 0, sizeof(Packet));
-                packet.seq_num = htons(seq);
-                packet.ack_num = htons(0);
-                packet.data_length = htons(bytesRead);
-                memcpy(packet.data, buffer, bytesRead);
-                packet.checksum = 0;
-                packet.checksum = htons(calculateChecksum(packet));
-                packet.send_time = chrono::steady_clock::now();
+                packet.set<Packet::Seq>(seq);
+                packet.set<Packet::Ack>(0);
+                slot.size = packet.finish(bytesRead);
+                slot.seq = seq;
+                slot.acked = false;
+                slot.send_time = chrono::steady_clock::now();
 
                 // Send the packet
-                ssize_t bytes_sent = sendto(sockfd, &packet, sizeof(Packet), 0, (const struct sockaddr*)&servaddr, len);
-                if (bytes_sent == -1) {
-                    perror("sendto failed");
-                    // Handle error
-                } else {
+                if (sendPacket(sockfd, slot.frame, slot.size, servaddr)) {
                     cout << "Sent packet seq: " << seq << endl;
                 }
+                loop.arm(timers[seq % WINDOW_SIZE], TIMEOUT_MS);
 
                 seq++;
             } else {
@@ -98,150 +102,102 @@ void sendFile(const char* filePath, int sockfd, struct sockaddr_in& servaddr) {
                 break;
             }
         }
+    };
+
+    loop.watch(sockfd, EPOLLIN, [&](uint32_t) {
+        unsigned char ack_buffer[Packet::max_size];
+        ssize_t n;
+        while ((n = recvfrom(sockfd, ack_buffer, sizeof(ack_buffer), 0, (struct sockaddr*)&servaddr, &len)) >= 0) {
+            FrameReader<Packet> ack_packet(ack_buffer, n);
+            if (!ack_packet.ok()) {
+                cout << "Received corrupted ACK packet" << endl;
+                continue;
+            }
 
-        // Set up select() for timeout handling
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(sockfd, &readfds);
-
-        struct timeval tv;
-        tv.tv_sec = 0;
-        tv.tv_usec = 100000; // 100 ms
-
-        int rv = select(sockfd + 1, &readfds, NULL, NULL, &tv);
-        if (rv == -1) {
-            perror("select");
-            // Handle error
-        } else if (rv == 0) {
-            // Timeout occurred, check for packet timeouts
-        } else {
-            if (FD_ISSET(sockfd, &readfds)) {
-                // Data is available to read
-                Packet ack_packet;
-                ssize_t n = recvfrom(sockfd, &ack_packet, sizeof(Packet), 0, (struct sockaddr*)&servaddr, &len);
-                if (n > 0) {
-                    // Convert fields from network byte order
-                    ack_packet.seq_num = ntohs(ack_packet.seq_num);
-                    ack_packet.ack_num = ntohs(ack_packet.ack_num);
-                    ack_packet.checksum = ntohs(ack_packet.checksum);
-
-                    uint16_t calc_checksum = calculateChecksum(ack_packet);
-                    if (ack_packet.checksum == calc_checksum) {
-                        if (ack_packet.ack_num == 1) {
-                            cout << "Received ACK for packet: " << ack_packet.seq_num << endl;
-                            int seq_index = ack_packet.seq_num % WINDOW_SIZE;
-                            window[seq_index].ack_num = 1;
-
-                            // Slide window if base packet is acknowledged
-                            while (window[base % WINDOW_SIZE].ack_num == 1 && base < seq) {
-                                base++;
-                            }
-                        } else if (ack_packet.ack_num == 2) {
-                            // Packet corrupted, retransmit
-                            cout << "Packet corrupted, retransmit seq: " << ack_packet.seq_num << endl;
-                            int seq_index = ack_packet.seq_num % WINDOW_SIZE;
-                            Packet& packet_to_resend = window[seq_index];
-                            packet_to_resend.send_time = chrono::steady_clock::now();
-                            ssize_t bytes_sent = sendto(sockfd, &packet_to_resend, sizeof(Packet), 0, (const struct sockaddr*)&servaddr, len);
-                            if (bytes_sent == -1) {
-                                perror("sendto failed");
-                            } else {
-                                cout << "Resent packet seq: " << ack_packet.seq_num << endl;
-                            }
-                        }
-                    } else {
-                        cout << "Received corrupted ACK packet" << endl;
-                    }
-                } else {
-                    perror("recvfrom failed");
+            // The wire carries 16 bits of seq; widen relative to base
+            int ack_seq = base + (uint16_t)(ack_packet.get<Packet::Seq>() - base);
+            int seq_index = ack_seq % WINDOW_SIZE;
+            Slot& slot = window[seq_index];
+            if (ack_seq < base || ack_seq >= seq || slot.seq != ack_seq) {
+                continue;  // Stale ACK for a slot that has been reused
+            }
+            if (ack_packet.get<Packet::Ack>() == 1) {
+                cout << "Received ACK for packet: " << ack_seq << endl;
+                slot.acked = true;
+                loop.cancel(timers[seq_index]);
+
+                // Slide window if base packet is acknowledged
+                while (base < seq && window[base % WINDOW_SIZE].acked) {
+                    base++;
                 }
+            } else if (ack_packet.get<Packet::Ack>() == 2) {
+                // Packet corrupted, retransmit
+                cout << "Packet corrupted, retransmit seq: " << ack_seq << endl;
+                slot.send_time = chrono::steady_clock::now();
+                if (sendPacket(sockfd, slot.frame, slot.size, servaddr)) {
+                    cout << "Resent packet seq: " << ack_seq << endl;
+                }
+                loop.arm(timers[seq_index], TIMEOUT_MS);
             }
         }
+        if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror("recvfrom failed");
+        }
 
-        // Check for timeouts and retransmit if necessary
-        now = chrono::steady_clock::now();
-        for (int i = base; i < seq; i++) {
-            Packet& packet = window[i % WINDOW_SIZE];
-            if (packet.ack_num != 1) {
-                auto time_since_sent = chrono::duration_cast<chrono::milliseconds>(now - packet.send_time);
-                if (time_since_sent.count() >= TIMEOUT_MS) {
-                    packet.send_time = now;
-                    // Resend packet
-                    ssize_t bytes_sent = sendto(sockfd, &packet, sizeof(Packet), 0, (const struct sockaddr*)&servaddr, len);
-                    if (bytes_sent == -1) {
-                        perror("sendto failed");
-                    } else {
-                        cout << "Timeout, retransmitted packet seq: " << ntohs(packet.seq_num) << endl;
-                    }
-                }
-            }
+        fillWindow();
+        if (doneReading && base >= seq) {
+            loop.stop();
         }
+    });
+
+    fillWindow();
+    if (!doneReading || base < seq) {
+        loop.run();
     }
+    loop.unwatch(sockfd);
 
-    // Send an end-of-file packet
-    Packet eof_packet;
-    memset(&eof_packet, 0, sizeof(Packet));
-    eof_packet.seq_num = htons(seq);
-    eof_packet.ack_num = htons(0);
-    eof_packet.data_length = 0; // No data
-    eof_packet.checksum = htons(calculateChecksum(eof_packet));
+    // Send an end-of-file packet: just the header, no data
+    unsigned char eof_packet[Packet::max_size];
+    FrameWriter<Packet> eof_writer(eof_packet);
+    eof_writer.set<Packet::Seq>(seq);
+    eof_writer.set<Packet::Ack>(0);
+    int eof_size = eof_writer.finish(0);
 
     // Send EOF packet until it's acknowledged
-    bool eof_acknowledged = false;
-    auto eof_send_time = chrono::steady_clock::now();
-
-    while (!eof_acknowledged) {
-        ssize_t bytes_sent = sendto(sockfd, &eof_packet, sizeof(Packet), 0, (const struct sockaddr*)&servaddr, len);
-        if (bytes_sent == -1) {
-            perror("sendto failed");
-        } else {
+    Timer eofTimer;
+    eofTimer.callback = [&]() {
+        cout << "Timeout waiting for EOF ACK, retransmitting EOF packet" << endl;
+        if (sendPacket(sockfd, eof_packet, eof_size, servaddr)) {
             cout << "Sent EOF packet" << endl;
         }
-
-        // Wait for ACK
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(sockfd, &readfds);
-
-        struct timeval tv;
-        tv.tv_sec = 0;
-        tv.tv_usec = 100000; // 100 ms
-
-        int rv = select(sockfd + 1, &readfds, NULL, NULL, &tv);
-        if (rv == -1) {
-            perror("select");
-            // Handle error
-        } else if (rv == 0) {
-            // Timeout occurred, check if we should resend EOF packet
-            auto time_since_sent = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - eof_send_time);
-            if (time_since_sent.count() >= TIMEOUT_MS) {
-                eof_send_time = chrono::steady_clock::now();
-                cout << "Timeout waiting for EOF ACK, retransmitting EOF packet" << endl;
-            }
-            continue;
-        } else {
-            if (FD_ISSET(sockfd, &readfds)) {
-                Packet ack_packet;
-                ssize_t n = recvfrom(sockfd, &ack_packet, sizeof(Packet), 0, (struct sockaddr*)&servaddr, &len);
-                if (n > 0) {
-                    ack_packet.seq_num = ntohs(ack_packet.seq_num);
-                    ack_packet.ack_num = ntohs(ack_packet.ack_num);
-                    ack_packet.checksum = ntohs(ack_packet.checksum);
-
-                    uint16_t calc_checksum = calculateChecksum(ack_packet);
-                    if (ack_packet.checksum == calc_checksum && ack_packet.seq_num == seq && ack_packet.ack_num == 1) {
-                        cout << "Received ACK for EOF packet" << endl;
-                        eof_acknowledged = true;
-                        break;
-                    } else {
-                        cout << "Received corrupted or incorrect ACK for EOF packet" << endl;
-                    }
-                } else {
-                    perror("recvfrom failed");
-                }
+        loop.arm(eofTimer, TIMEOUT_MS);
+    };
+
+    loop.watch(sockfd, EPOLLIN, [&](uint32_t) {
+        unsigned char ack_buffer[Packet::max_size];
+        ssize_t n;
+        while ((n = recvfrom(sockfd, ack_buffer, sizeof(ack_buffer), 0, (struct sockaddr*)&servaddr, &len)) >= 0) {
+            FrameReader<Packet> ack_packet(ack_buffer, n);
+            if (ack_packet.ok() && ack_packet.get<Packet::Seq>() == (uint16_t)seq && ack_packet.get<Packet::Ack>() == 1) {
+                cout << "Received ACK for EOF packet" << endl;
+                loop.cancel(eofTimer);
+                loop.stop();
+                return;
+            } else {
+                cout << "Received corrupted or incorrect ACK for EOF packet" << endl;
             }
         }
+        if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror("recvfrom failed");
+        }
+    });
+
+    if (sendPacket(sockfd, eof_packet, eof_size, servaddr)) {
+        cout << "Sent EOF packet" << endl;
     }
+    loop.arm(eofTimer, TIMEOUT_MS);
+    loop.run();
+    loop.unwatch(sockfd);
 
     cout << "File transfer completed successfully." << endl;
     file.close();
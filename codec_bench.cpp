@@ -0,0 +1,364 @@
+// codec_bench.cpp
+// Per-frame cost of the protocol's hot kernels: the sendfile checksum,
+// encode and decode of data frames and ACKs, checksummed and sealed under
+// each AEAD suite, client packets, and the sequence-keyed maps behind the
+// sender's frame_map and the receiver's frame_buffer. Candidate
+// replacements run next to the kernels they would replace.
+//
+// Each kernel is warmed up, then timed over several runs on one pinned
+// CPU; the median run is reported in ns per frame and GB/s of payload,
+// with the fastest run beside it to show the spread.
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <getopt.h>
+#include <sched.h>
+#include "frame_codec.h"
+#include "frame_cipher.h"
+
+using namespace std;
+
+#define ITERATIONS 1000000
+#define REPEATS 5
+
+// Keep the compiler from discarding the benchmarked work
+volatile unsigned long sink;
+
+int iterations = ITERATIONS;
+int repeats = REPEATS;
+bool json = false;
+string filter;  // Only kernels whose name contains this
+int reported = 0;
+
+// Median and fastest of the timed runs, in ns per op
+struct Timing {
+    double median;
+    double best;
+};
+
+// op gets a count that runs on across the warm-up and every run, so
+// kernels that keep state between calls see one long stream of frames
+template <typename F>
+Timing time_op(F op) {
+    int count = 0;
+    for (int i = 0; i < iterations / 10; i++) {
+        op(count++);  // Warm up
+    }
+    vector<double> runs;
+    for (int run = 0; run < repeats; run++) {
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++) {
+            op(count++);
+        }
+        chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+        runs.push_back(elapsed.count() / iterations);
+    }
+    sort(runs.begin(), runs.end());
+    return Timing{runs[runs.size() / 2], runs[0]};
+}
+
+void report(const string &name, size_t payload_size, const Timing &t) {
+    double gbps = t.median > 0 ? payload_size / t.median : 0;  // Bytes per ns is GB/s
+    if (json) {
+        cout << (reported ? ",\n" : "[\n") << "  {\"name\": \"" << name << "\", \"payload_bytes\": " << payload_size
+             << fixed << setprecision(2) << ", \"ns_per_frame\": " << t.median << ", \"ns_per_frame_best\": " << t.best
+             << setprecision(3) << ", \"gb_per_s\": " << gbps << "}";
+    } else {
+        cout << left << setw(30) << name << right << setw(6) << payload_size << " B "
+             << fixed << setprecision(1) << setw(10) << t.median << " ns/frame "
+             << setw(8) << t.best << " best "
+             << setprecision(3) << setw(8) << gbps << " GB/s" << endl;
+    }
+    reported++;
+}
+
+template <typename F>
+void bench(const string &name, size_t payload_size, F op) {
+    if (name.find(filter) == string::npos) {
+        return;
+    }
+    report(name, payload_size, time_op(op));
+}
+
+// Candidate for checksum(): the same end-around-carry sum, taken eight
+// bytes at a time. Bytes add into 16-bit lanes, which are folded once at
+// the end; ones' complement addition does not care when carries wrap.
+inline unsigned char checksum_wide(const unsigned char *frame, int count) {
+    const uint64_t low_bytes = 0x00FF00FF00FF00FFULL;
+    uint64_t sum = 0;
+    while (count >= 8) {
+        // Each word adds at most 510 to a lane, so 64 words cannot overflow one
+        int words = min(count / 8, 64);
+        uint64_t lanes = 0;
+        for (int i = 0; i < words; i++) {
+            uint64_t word;
+            memcpy(&word, frame, 8);
+            lanes += (word & low_bytes) + ((word >> 8) & low_bytes);
+            frame += 8;
+        }
+        count -= words * 8;
+        sum += (lanes & 0xFFFF) + ((lanes >> 16) & 0xFFFF) + ((lanes >> 32) & 0xFFFF) + (lanes >> 48);
+    }
+    while (count--) {
+        sum += *frame++;
+    }
+    while (sum >> 8) {
+        sum = (sum & 0xFF) + (sum >> 8);
+    }
+    return (unsigned char)sum;
+}
+
+// Stand-in for the per-frame state sendfile keeps in frame_map
+struct WindowEntry {
+    unsigned char *data = nullptr;
+    int size = 0;
+    bool acked = false;
+    bool retransmitted = false;
+    int path = 0;
+    chrono::steady_clock::time_point send_time;
+    chrono::steady_clock::time_point deadline;
+};
+
+// Candidate for the maps: a slot per sequence number modulo a power of two
+// at least the window, valid while no two live frames are a window apart
+template <typename T>
+class SeqRing {
+public:
+    explicit SeqRing(int window) {
+        size_t capacity = 1;
+        while (capacity < (size_t)window) {
+            capacity <<= 1;
+        }
+        slots_.resize(capacity);
+        used_.resize(capacity);
+        mask_ = capacity - 1;
+    }
+
+    bool has(int seq) const { return used_[seq & mask_]; }
+    T &at(int seq) { return slots_[seq & mask_]; }
+
+    T &insert(int seq) {
+        used_[seq & mask_] = true;
+        return slots_[seq & mask_];
+    }
+
+    void erase(int seq) { used_[seq & mask_] = false; }
+
+private:
+    vector<T> slots_;
+    vector<bool> used_;
+    size_t mask_;
+};
+
+void pin_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+        perror("Failed to pin CPU");
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int cpu = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:n:r:k:j")) != -1) {
+        switch (opt) {
+        case 'c':
+            cpu = atoi(optarg);
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'r':
+            repeats = atoi(optarg);
+            break;
+        case 'k':
+            filter = optarg;
+            break;
+        case 'j':
+            json = true;
+            break;
+        default:
+            cerr << "Usage: " << argv[0] << " [-c <cpu>] [-n <iterations>] [-r <repeats>] [-k <kernel name filter>] [-j]" << endl;
+            exit(1);
+        }
+    }
+    if (iterations < 1 || repeats < 1) {
+        cerr << "Iterations and repeats must be positive" << endl;
+        exit(1);
+    }
+    pin_cpu(cpu);
+    if (!json) {
+        cout << "CPU " << cpu << ", " << iterations << " iterations, median of " << repeats << " runs" << endl;
+    }
+
+    unsigned char payload[MAX_PACKET_DATA];
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = rand();
+    }
+    unsigned char frame[Packet::max_size];
+
+    for (int size : {16, 64, 256, 512, 1024}) {
+        for (int offset = 0; offset <= size; offset++) {
+            if (checksum_wide(payload + offset, size - offset) != checksum(payload + offset, size - offset)) {
+                cerr << "checksum_wide disagrees with checksum at " << size - offset << " bytes" << endl;
+                exit(1);
+            }
+        }
+        bench("checksum", size, [&](int i) {
+            payload[0] = i;
+            sink = checksum(payload, size);
+        });
+        bench("checksum wide", size, [&](int i) {
+            payload[0] = i;
+            sink = checksum_wide(payload, size);
+        });
+    }
+
+    for (size_t size : {0, 64, 256, 512}) {
+        bench("data frame encode", size, [&](int i) {
+            FrameWriter<DataFrame> out(frame);
+            out.set<DataFrame::Type>(FILEDATA);
+            out.set<DataFrame::Seq>(i);
+            memcpy(out.payload(), payload, size);
+            sink = out.finish(size);
+        });
+        FrameWriter<DataFrame> out(frame);
+        out.set<DataFrame::Type>(FILEDATA);
+        memcpy(out.payload(), payload, size);
+        int frame_size = out.finish(size);
+        bench("data frame decode", size, [&](int) {
+            FrameReader<DataFrame> in(frame, frame_size);
+            sink = in.ok() + in.get<DataFrame::Seq>() + in.payload_size();
+        });
+    }
+
+    // Sealed frames: seal encrypts straight from the payload buffer. open
+    // decrypts in place, so each run opens a fresh copy of a sealed frame.
+    unsigned char key[KEY_SIZE];
+    for (unsigned char &byte : key) {
+        byte = rand();
+    }
+    unsigned char sealed[MAX_FRAME_SIZE];
+    for (CipherSuite suite : {AES_256_GCM, CHACHA20_POLY1305}) {
+        FrameCipher cipher(key, suite);
+        for (size_t size : {64, 512}) {
+            bench(string(suite_name(suite)) + " seal", size, [&](int i) {
+                FrameWriter<SealedFrame> out(frame);
+                out.set<SealedFrame::Type>(FILEDATA);
+                out.set<SealedFrame::Seq>(i);
+                sink = out.finish(size);
+                cipher.seal<SealedFrame>(frame, payload, size, FILEDATA, i);
+            });
+            FrameWriter<SealedFrame> out(sealed);
+            out.set<SealedFrame::Type>(FILEDATA);
+            out.set<SealedFrame::Seq>(7);
+            int frame_size = out.finish(size);
+            cipher.seal<SealedFrame>(sealed, payload, size, FILEDATA, 7);
+            bench(string(suite_name(suite)) + " open", size, [&](int) {
+                memcpy(frame, sealed, frame_size);
+                FrameReader<SealedFrame> in(frame, frame_size);
+                sink = in.ok() && cipher.open<SealedFrame>(frame, in.payload_size(), FILEDATA, in.get<SealedFrame::Seq>());
+            });
+        }
+    }
+
+    bench("ack encode", 0, [&](int i) {
+        FrameWriter<AckFrame> out(frame);
+        out.set<AckFrame::Flag>(ACK_OK);
+        out.set<AckFrame::Seq>(i);
+        out.set<AckFrame::NextExpected>(i + 1);
+        out.set<AckFrame::Window>(64);
+        out.set<AckFrame::Drops>(0);
+        sink = out.finish(0);
+    });
+    bench("ack decode", 0, [&](int) {
+        FrameReader<AckFrame> in(frame, AckFrame::max_size);
+        sink = in.ok() + in.get<AckFrame::NextExpected>() + in.get<AckFrame::Window>();
+    });
+
+    for (size_t size : {0, 512, 1024}) {
+        bench("packet encode", size, [&](int i) {
+            FrameWriter<Packet> out(frame);
+            out.set<Packet::Seq>(i);
+            out.set<Packet::Ack>(0);
+            memcpy(out.payload(), payload, size);
+            sink = out.finish(size);
+        });
+        FrameWriter<Packet> out(frame);
+        int frame_size = out.finish(size);
+        bench("packet decode", size, [&](int) {
+            FrameReader<Packet> in(frame, frame_size);
+            sink = in.ok() + in.get<Packet::Seq>() + in.payload_size();
+        });
+    }
+
+    // Sender window: each op retires frame i - window on a cumulative ACK
+    // and sends frame i
+    for (int window : {64, 1024, 16384}) {
+        map<int, WindowEntry> frame_map;
+        bench("frame_map std::map w=" + to_string(window), MAX_DATA_SIZE, [&](int i) {
+            auto it = frame_map.find(i - window);
+            if (it != frame_map.end()) {
+                sink = it->second.size;
+                frame_map.erase(it);
+            }
+            frame_map[i].size = MAX_DATA_SIZE;
+        });
+        SeqRing<WindowEntry> ring(window);
+        bench("frame_map ring w=" + to_string(window), MAX_DATA_SIZE, [&](int i) {
+            if (i >= window && ring.has(i - window)) {
+                sink = ring.at(i - window).size;
+                ring.erase(i - window);
+            }
+            ring.insert(i).size = MAX_DATA_SIZE;
+        });
+    }
+
+    // Receiver reorder buffer: every window frames one is late, the rest
+    // wait in the buffer and drain in order once it arrives
+    for (int window : {64, 1024, 16384}) {
+        map<int, int> frame_buffer;
+        int expected = 0;
+        bench("frame_buffer std::map w=" + to_string(window), MAX_DATA_SIZE, [&](int i) {
+            int seq = i % window == window - 1 ? i - (window - 1) : i + 1;  // The late one comes last
+            if (seq != expected) {
+                frame_buffer[seq] = MAX_DATA_SIZE;
+                return;
+            }
+            expected++;
+            while (frame_buffer.count(expected) > 0) {
+                sink = frame_buffer[expected];
+                frame_buffer.erase(expected);
+                expected++;
+            }
+        });
+        SeqRing<int> ring(window);
+        expected = 0;
+        bench("frame_buffer ring w=" + to_string(window), MAX_DATA_SIZE, [&](int i) {
+            int seq = i % window == window - 1 ? i - (window - 1) : i + 1;
+            if (seq != expected) {
+                ring.insert(seq) = MAX_DATA_SIZE;
+                return;
+            }
+            expected++;
+            while (ring.has(expected)) {
+                sink = ring.at(expected);
+                ring.erase(expected);
+                expected++;
+            }
+        });
+    }
+
+    if (json) {
+        cout << (reported ? "\n]" : "[]") << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,149 @@
+// event_loop.h
+// epoll based event loop with a timerfd driving a TimerWheel at 1 ms ticks.
+// The timerfd only runs while timers are pending, and each expiry touches a
+// single wheel slot, so idle loops and large windows both stay cheap.
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include "timer_wheel.h"
+
+#define TICK_MS 1  // Timer resolution
+#define MAX_EVENTS 64
+
+class EventLoop {
+public:
+    EventLoop() : start_(std::chrono::steady_clock::now()), wheel_(0), timer_running_(false), running_(false) {
+        epfd_ = epoll_create1(EPOLL_CLOEXEC);
+        timerfd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (epfd_ < 0 || timerfd_ < 0) {
+            perror("Event loop creation failed");
+            exit(1);
+        }
+        watch(timerfd_, EPOLLIN, [this](uint32_t) { on_tick(); });
+    }
+
+    ~EventLoop() {
+        close(timerfd_);
+        close(epfd_);
+    }
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    // Call handler with the ready events whenever fd becomes ready
+    void watch(int fd, uint32_t events, std::function<void(uint32_t)> handler) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.fd = fd;
+        int op = handlers_.count(fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        if (epoll_ctl(epfd_, op, fd, &ev) < 0) {
+            perror("epoll_ctl failed");
+            exit(1);
+        }
+        handlers_[fd] = handler;
+    }
+
+    void unwatch(int fd) {
+        if (handlers_.erase(fd)) {
+            epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+        }
+    }
+
+    // Fire the timer's callback after ms milliseconds
+    void arm(Timer &t, int ms) {
+        if (wheel_.empty()) {
+            wheel_.advance(now_ticks());
+        }
+        wheel_.arm(&t, now_ticks() + (ms + TICK_MS - 1) / TICK_MS);
+        update_timerfd();
+    }
+
+    void cancel(Timer &t) {
+        wheel_.cancel(&t);
+    }
+
+    int pending_timers() const { return wheel_.size(); }
+
+    // Dispatch events until stop() is called
+    void run() {
+        running_ = true;
+        struct epoll_event events[MAX_EVENTS];
+        while (running_) {
+            if (before_wait_) {
+                before_wait_();
+            }
+            int n = epoll_wait(epfd_, events, MAX_EVENTS, -1);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("epoll_wait failed");
+                exit(1);
+            }
+            for (int i = 0; i < n && running_; i++) {
+                auto it = handlers_.find(events[i].data.fd);
+                if (it != handlers_.end()) {
+                    auto handler = it->second;  // May unwatch itself
+                    handler(events[i].events);
+                }
+            }
+            update_timerfd();
+        }
+    }
+
+    void stop() { running_ = false; }
+
+    // Run hook every time the loop is about to block, e.g. to flush batched I/O
+    void before_wait(std::function<void()> hook) { before_wait_ = hook; }
+
+private:
+    uint64_t now_ticks() const {
+        auto elapsed = std::chrono::steady_clock::now() - start_;
+        return std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() / TICK_MS;
+    }
+
+    void on_tick() {
+        uint64_t expirations;
+        while (read(timerfd_, &expirations, sizeof(expirations)) > 0) {
+        }
+        wheel_.advance(now_ticks());
+    }
+
+    // Keep the periodic tick running only while something is armed
+    void update_timerfd() {
+        bool want = !wheel_.empty();
+        if (want == timer_running_) {
+            return;
+        }
+        struct itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        if (want) {
+            spec.it_value.tv_nsec = TICK_MS * 1000000L;
+            spec.it_interval.tv_nsec = TICK_MS * 1000000L;
+        }
+        timerfd_settime(timerfd_, 0, &spec, nullptr);
+        timer_running_ = want;
+    }
+
+    std::chrono::steady_clock::time_point start_;
+    TimerWheel wheel_;
+    std::map<int, std::function<void(uint32_t)>> handlers_;
+    std::function<void()> before_wait_;
+    int epfd_;
+    int timerfd_;
+    bool timer_running_;
+    bool running_;
+};
+
+#endif
@@ -0,0 +1,163 @@
+// frame_cipher.h
+// Authenticated encryption of sendfile/recvfile frames under a pre-shared
+// key. The payload is encrypted straight into the frame and the AEAD tag
+// stands in for the checksum, with the whole frame header as associated
+// data, so a single pass over the payload both hides it and detects any
+// change to the frame.
+// The 96-bit nonce is [salt 7][kind 1][counter 4]: data frames count by
+// sequence number and use their type as the kind, ACKs carry a counter of
+// their own. The salt is random per sender session and per receiver, so
+// sequence numbers that start over never reuse a nonce under the same key.
+#ifndef FRAME_CIPHER_H
+#define FRAME_CIPHER_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include "frame_codec.h"
+
+#define KEY_SIZE 32
+#define SALT_SIZE 7
+#define NONCE_SIZE 12
+#define TAG_SIZE 16
+#define ACK_NONCE_KIND 0x80  // Apart from every PacketType
+
+enum CipherSuite {
+    AES_256_GCM = 1,
+    CHACHA20_POLY1305 = 2
+};
+
+// AES-GCM where the CPU has AES-NI and carry-less multiply for GHASH,
+// ChaCha20-Poly1305 where table-free software is faster
+inline CipherSuite preferred_suite() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul") ? AES_256_GCM : CHACHA20_POLY1305;
+}
+
+inline const char *suite_name(int suite) {
+    return suite == AES_256_GCM ? "AES-256-GCM" : suite == CHACHA20_POLY1305 ? "ChaCha20-Poly1305" : "unknown";
+}
+
+// Key file holding 64 hex digits, e.g. from `openssl rand -hex 32`
+inline bool load_key(const char *path, unsigned char *key) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+    bool ok = true;
+    for (int i = 0; i < KEY_SIZE && ok; i++) {
+        unsigned int byte;
+        ok = fscanf(file, "%2x", &byte) == 1;
+        key[i] = byte;
+    }
+    fclose(file);
+    return ok;
+}
+
+// Seals outgoing and opens incoming frames. OpenSSL contexts are not
+// thread-safe, so every thread works on its own copy; copies share the key,
+// suite and salt. Each context holds its key schedule, only the nonce
+// changes from frame to frame.
+class FrameCipher {
+public:
+    FrameCipher(const unsigned char *key, CipherSuite suite) : suite_(suite) {
+        memcpy(key_, key, KEY_SIZE);
+        if (RAND_bytes(salt_, SALT_SIZE) != 1) {
+            fprintf(stderr, "No randomness for the nonce salt\n");
+            exit(1);
+        }
+        memset(contexts_, 0, sizeof(contexts_));
+    }
+
+    FrameCipher(const FrameCipher &other) : suite_(other.suite_) {
+        memcpy(key_, other.key_, KEY_SIZE);
+        memcpy(salt_, other.salt_, SALT_SIZE);
+        memset(contexts_, 0, sizeof(contexts_));
+    }
+
+    FrameCipher &operator=(const FrameCipher &) = delete;
+
+    ~FrameCipher() {
+        for (auto &pair : contexts_) {
+            EVP_CIPHER_CTX_free(pair[0]);
+            EVP_CIPHER_CTX_free(pair[1]);
+        }
+    }
+
+    CipherSuite suite() const { return suite_; }
+
+    // Stamp suite and salt into the header, encrypt data into the payload
+    // (data may already be the payload) and append the tag. The other
+    // header fields must be set first.
+    template <typename Layout>
+    void seal(unsigned char *frame, const unsigned char *data, size_t payload_size, uint8_t kind, uint32_t counter) {
+        Layout::Suite::store(frame, suite_);
+        memcpy(frame + Layout::salt_offset, salt_, SALT_SIZE);
+        unsigned char nonce[NONCE_SIZE];
+        make_nonce(salt_, kind, counter, nonce);
+
+        EVP_CIPHER_CTX *ctx = context(suite_, true);
+        unsigned char *payload = frame + Layout::header_size;
+        int len;
+        EVP_EncryptInit_ex(ctx, nullptr, nullptr, nullptr, nonce);
+        EVP_EncryptUpdate(ctx, nullptr, &len, frame, Layout::header_size);
+        if (payload_size > 0) {
+            EVP_EncryptUpdate(ctx, payload, &len, data, payload_size);
+        }
+        EVP_EncryptFinal_ex(ctx, payload + payload_size, &len);
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, TAG_SIZE, payload + payload_size);
+    }
+
+    // Check the tag and decrypt the payload in place, under whichever suite
+    // the peer chose; false if the frame was not sealed with our key
+    template <typename Layout>
+    bool open(unsigned char *frame, size_t payload_size, uint8_t kind, uint32_t counter) {
+        int suite = Layout::Suite::load(frame);
+        if (suite != AES_256_GCM && suite != CHACHA20_POLY1305) {
+            return false;
+        }
+        unsigned char nonce[NONCE_SIZE];
+        make_nonce(frame + Layout::salt_offset, kind, counter, nonce);
+
+        EVP_CIPHER_CTX *ctx = context((CipherSuite)suite, false);
+        unsigned char *payload = frame + Layout::header_size;
+        int len;
+        EVP_DecryptInit_ex(ctx, nullptr, nullptr, nullptr, nonce);
+        EVP_DecryptUpdate(ctx, nullptr, &len, frame, Layout::header_size);
+        if (payload_size > 0) {
+            EVP_DecryptUpdate(ctx, payload, &len, payload, payload_size);
+        }
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, TAG_SIZE, payload + payload_size);
+        return EVP_DecryptFinal_ex(ctx, payload + payload_size, &len) > 0;
+    }
+
+private:
+    static void make_nonce(const unsigned char *salt, uint8_t kind, uint32_t counter, unsigned char *nonce) {
+        memcpy(nonce, salt, SALT_SIZE);
+        nonce[SALT_SIZE] = kind;
+        counter = to_wire(counter);
+        memcpy(nonce + SALT_SIZE + 1, &counter, sizeof(counter));
+    }
+
+    EVP_CIPHER_CTX *context(CipherSuite suite, bool encrypt) {
+        EVP_CIPHER_CTX *&ctx = contexts_[suite - 1][encrypt];
+        if (!ctx) {
+            const EVP_CIPHER *cipher = suite == AES_256_GCM ? EVP_aes_256_gcm() : EVP_chacha20_poly1305();
+            ctx = EVP_CIPHER_CTX_new();
+            if (!ctx || EVP_CipherInit_ex(ctx, cipher, nullptr, key_, nullptr, encrypt) != 1) {
+                fprintf(stderr, "Failed to set up %s\n", suite_name(suite));
+                exit(1);
+            }
+        }
+        return ctx;
+    }
+
+    CipherSuite suite_;
+    unsigned char key_[KEY_SIZE];
+    unsigned char salt_[SALT_SIZE];
+    EVP_CIPHER_CTX *contexts_[2][2];  // [suite - 1][encrypt]
+};
+
+#endif
@@ -0,0 +1,355 @@
+// frame_codec.h
+// Wire formats of both protocols, described as fixed layouts with constexpr
+// field offsets. FrameWriter and FrameReader work in place on the datagram
+// buffer: header fields are stored and loaded at their offsets, the payload
+// is a pointer into the buffer, and every length taken off the wire is
+// checked against the layout and the received size before it is used.
+#ifndef FRAME_CODEC_H
+#define FRAME_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <arpa/inet.h>
+#include <endian.h>
+
+#define MAX_DATA_SIZE 512  // Each sendfile frame carries up to 512 bytes
+#define MAX_PACKET_DATA 1024  // Each client packet carries up to 1024 bytes
+
+// Integers travel big-endian
+inline uint8_t to_wire(uint8_t v) { return v; }
+inline uint16_t to_wire(uint16_t v) { return htons(v); }
+inline uint32_t to_wire(uint32_t v) { return htonl(v); }
+inline uint64_t to_wire(uint64_t v) { return htobe64(v); }
+inline uint8_t from_wire(uint8_t v) { return v; }
+inline uint16_t from_wire(uint16_t v) { return ntohs(v); }
+inline uint32_t from_wire(uint32_t v) { return ntohl(v); }
+inline uint64_t from_wire(uint64_t v) { return be64toh(v); }
+
+// A header field of type T at a fixed byte offset. The fixed-size memcpy
+// compiles to a single unaligned load or store.
+template <typename T, size_t Offset>
+struct Field {
+    typedef T type;
+    static constexpr size_t offset = Offset;
+    static constexpr size_t end = Offset + sizeof(T);
+
+    static T load(const unsigned char *frame) {
+        T v;
+        memcpy(&v, frame + Offset, sizeof(T));
+        return from_wire(v);
+    }
+
+    static void store(unsigned char *frame, T v) {
+        v = to_wire(v);
+        memcpy(frame + Offset, &v, sizeof(T));
+    }
+};
+
+// Header, payload of up to MaxPayload bytes, then a trailer. Only the real
+// payload goes on the wire, so a frame is header + payload + trailer bytes.
+template <size_t HeaderSize, size_t MaxPayload, size_t TrailerSize>
+struct FrameLayout {
+    static constexpr size_t header_size = HeaderSize;
+    static constexpr size_t max_payload = MaxPayload;
+    static constexpr size_t trailer_size = TrailerSize;
+    static constexpr size_t min_size = HeaderSize + TrailerSize;
+    static constexpr size_t max_size = HeaderSize + MaxPayload + TrailerSize;
+
+    static constexpr size_t wire_size(size_t payload_size) { return HeaderSize + payload_size + TrailerSize; }
+};
+
+// 8-bit end-around-carry sum used by sendfile/recvfile
+inline unsigned char checksum(const unsigned char *frame, int count) {
+    unsigned long sum = 0;
+    while (count--) {
+        sum += *frame++;
+        if (sum & 0xFF00) {
+            sum &= 0xFF;
+            sum++;
+        }
+    }
+    return (unsigned char)(sum & 0xFF);
+}
+
+// 16-bit ones' complement sum (RFC 1071) used by client/server
+inline uint16_t internet_checksum(const unsigned char *data, size_t count, uint32_t sum = 0) {
+    while (count > 1) {
+        sum += (data[0] << 8) | data[1];
+        data += 2;
+        count -= 2;
+    }
+    if (count) {
+        sum += data[0] << 8;
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+enum PacketType {
+    FILENAME = 1,
+    FILEDATA = 2,
+    END_OF_TRANSFER = 3,
+    WINDOW_PROBE = 4,
+    CHUNK_MANIFEST = 5,
+    CHUNK_QUERY = 6,
+    ZERO_RANGE = 7
+};
+
+// First byte of every recvfile -> sendfile datagram
+enum AckFlag {
+    ACK_ERROR = 0,
+    ACK_OK = 1,
+    ACK_NEEDS = 2  // NeedsAck, answering a CHUNK_QUERY
+};
+
+// sendfile -> recvfile: [type 1][seq 4][size 4][data][checksum 1]
+struct DataFrame : FrameLayout<9, MAX_DATA_SIZE, 1> {
+    typedef Field<uint8_t, 0> Type;
+    typedef Field<uint32_t, 1> Seq;
+    typedef Field<uint32_t, 5> Length;
+
+    // Checksum follows the payload and covers everything before it
+    static void seal(unsigned char *frame, size_t payload_size) {
+        frame[header_size + payload_size] = checksum(frame, header_size + payload_size);
+    }
+
+    static bool intact(const unsigned char *frame, size_t payload_size) {
+        return frame[header_size + payload_size] == checksum(frame, header_size + payload_size);
+    }
+};
+
+// Payload of the FILENAME frame: [file size 8][sender window 4][path]
+struct SessionHeader {
+    typedef Field<uint64_t, 0> FileSize;
+    typedef Field<uint32_t, 8> Window;
+    static constexpr size_t size = 12;
+    static constexpr size_t max_path = MAX_DATA_SIZE - size;
+    static constexpr uint64_t unknown_size = UINT64_MAX;  // Streamed input, length known only at EOT
+};
+
+// Deduplicated files list their chunks in CHUNK_MANIFEST frames after the
+// session header, each entry [chunk hash 16][chunk size 4]
+struct ManifestEntry {
+    static constexpr size_t hash_size = 16;
+    typedef Field<uint32_t, hash_size> Size;
+    static constexpr size_t size = hash_size + 4;
+    static constexpr size_t per_frame = MAX_DATA_SIZE / size;
+};
+
+// Payload of a CHUNK_QUERY frame: which manifest entries the receiver
+// should say it lacks, [first entry 4][entry count 2]
+struct ChunkQuery {
+    typedef Field<uint32_t, 0> First;
+    typedef Field<uint16_t, 4> Count;
+    static constexpr size_t size = 6;
+    static constexpr size_t max_count = MAX_DATA_SIZE * 8;  // One bit each in the answer
+};
+
+// Payload of a ZERO_RANGE frame, which stands in the data stream for a
+// hole or a run of zero bytes: [length 8]
+struct ZeroRange {
+    typedef Field<uint64_t, 0> Length;
+    static constexpr size_t size = 8;
+};
+
+// recvfile -> sendfile: [flag 1][seq 4][next expected 4][window 4][kernel drops 4][checksum 1]
+struct AckFrame : FrameLayout<17, 0, 1> {
+    typedef Field<uint8_t, 0> Flag;
+    typedef Field<uint32_t, 1> Seq;
+    typedef Field<uint32_t, 5> NextExpected;
+    typedef Field<uint32_t, 9> Window;
+    typedef Field<uint32_t, 13> Drops;
+    typedef void Length;  // Fixed size, no payload
+
+    static void seal(unsigned char *frame, size_t) {
+        frame[header_size] = checksum(frame, header_size);
+    }
+
+    static bool intact(const unsigned char *frame, size_t) {
+        return frame[header_size] == checksum(frame, header_size);
+    }
+};
+
+// recvfile -> sendfile, answering a CHUNK_QUERY: the ACK fields, then one
+// bit per queried entry, set when the receiver needs the chunk's data
+// [flag 1][seq 4][next expected 4][window 4][kernel drops 4][bitmap size 2][bitmap][checksum 1]
+struct NeedsAck : FrameLayout<19, MAX_DATA_SIZE, 1> {
+    typedef AckFrame::Flag Flag;
+    typedef AckFrame::Seq Seq;
+    typedef AckFrame::NextExpected NextExpected;
+    typedef AckFrame::Window Window;
+    typedef AckFrame::Drops Drops;
+    typedef Field<uint16_t, 17> Length;
+
+    static void seal(unsigned char *frame, size_t payload_size) {
+        frame[header_size + payload_size] = checksum(frame, header_size + payload_size);
+    }
+
+    static bool intact(const unsigned char *frame, size_t payload_size) {
+        return frame[header_size + payload_size] == checksum(frame, header_size + payload_size);
+    }
+};
+
+// With a pre-shared key the checksum gives way to an AEAD tag, and the
+// header names the cipher suite and the sender's nonce salt. The payload is
+// ciphertext; FrameCipher (frame_cipher.h) writes and checks the tag, so
+// seal() and intact() are no-ops here.
+// sendfile -> recvfile: [type 1][seq 4][size 4][suite 1][salt 7][ciphertext][tag 16]
+struct SealedFrame : FrameLayout<17, MAX_DATA_SIZE, 16> {
+    typedef DataFrame::Type Type;
+    typedef DataFrame::Seq Seq;
+    typedef DataFrame::Length Length;
+    typedef Field<uint8_t, 9> Suite;
+    static constexpr size_t salt_offset = 10;
+
+    static void seal(unsigned char *, size_t) {}
+    static bool intact(const unsigned char *, size_t) { return true; }
+};
+
+// recvfile -> sendfile: AckFrame fields, [suite 1][salt 7][ack counter 4][tag 16]
+struct SealedAck : FrameLayout<29, 0, 16> {
+    typedef AckFrame::Flag Flag;
+    typedef AckFrame::Seq Seq;
+    typedef AckFrame::NextExpected NextExpected;
+    typedef AckFrame::Window Window;
+    typedef AckFrame::Drops Drops;
+    typedef Field<uint8_t, 17> Suite;
+    static constexpr size_t salt_offset = 18;
+    typedef Field<uint32_t, 25> Counter;  // ACK contents repeat, so their nonces count ACKs instead
+    typedef void Length;
+
+    static void seal(unsigned char *, size_t) {}
+    static bool intact(const unsigned char *, size_t) { return true; }
+};
+
+// recvfile -> sendfile: NeedsAck fields, [suite 1][salt 7][ack counter 4][bitmap size 2][bitmap][tag 16]
+struct SealedNeedsAck : FrameLayout<31, MAX_DATA_SIZE, 16> {
+    typedef AckFrame::Flag Flag;
+    typedef AckFrame::Seq Seq;
+    typedef AckFrame::NextExpected NextExpected;
+    typedef AckFrame::Window Window;
+    typedef AckFrame::Drops Drops;
+    typedef SealedAck::Suite Suite;
+    static constexpr size_t salt_offset = SealedAck::salt_offset;
+    typedef SealedAck::Counter Counter;
+    typedef Field<uint16_t, 29> Length;
+
+    static void seal(unsigned char *, size_t) {}
+    static bool intact(const unsigned char *, size_t) { return true; }
+};
+
+// client <-> server: [seq 2][ack 2][checksum 2][length 2][data]
+struct Packet : FrameLayout<8, MAX_PACKET_DATA, 0> {
+    typedef Field<uint16_t, 0> Seq;
+    typedef Field<uint16_t, 2> Ack;
+    typedef Field<uint16_t, 4> Checksum;
+    typedef Field<uint16_t, 6> Length;
+
+    // Covers seq, ack, length and the payload
+    static uint16_t sum(const unsigned char *frame, size_t payload_size) {
+        uint32_t partial = Seq::load(frame) + Ack::load(frame) + Length::load(frame);
+        return internet_checksum(frame + header_size, payload_size, partial);
+    }
+
+    static void seal(unsigned char *frame, size_t payload_size) {
+        Checksum::store(frame, sum(frame, payload_size));
+    }
+
+    static bool intact(const unsigned char *frame, size_t payload_size) {
+        return Checksum::load(frame) == sum(frame, payload_size);
+    }
+};
+
+// Buffer sizes, large enough for either form
+#define MAX_FRAME_SIZE SealedFrame::max_size  // Frame size: headers + data + checksum or tag
+#define ACK_SIZE SealedNeedsAck::max_size  // Flag + seq_num + next expected + advertised window + kernel drops + needs bitmap + checksum or tag
+
+// Payload length handling for layouts with and without a length field
+template <typename Layout, typename Length = typename Layout::Length>
+struct PayloadLength {
+    static size_t load(const unsigned char *frame) { return Length::load(frame); }
+    static void store(unsigned char *frame, size_t size) { Length::store(frame, (typename Length::type)size); }
+};
+
+template <typename Layout>
+struct PayloadLength<Layout, void> {
+    static size_t load(const unsigned char *) { return 0; }
+    static void store(unsigned char *, size_t) {}
+};
+
+// Encoding view over a caller-owned buffer of at least Layout::max_size
+// bytes. Fill the header fields and the payload in place, then finish().
+template <typename Layout>
+class FrameWriter {
+public:
+    explicit FrameWriter(unsigned char *frame) : frame_(frame) {}
+
+    template <typename F>
+    void set(typename F::type v) { F::store(frame_, v); }
+
+    unsigned char *payload() { return frame_ + Layout::header_size; }
+
+    // Record the payload length and seal the frame; the datagram size, or
+    // -1 when the payload does not fit the layout
+    int finish(size_t payload_size) {
+        if (payload_size > Layout::max_payload) {
+            return -1;
+        }
+        PayloadLength<Layout>::store(frame_, payload_size);
+        Layout::seal(frame_, payload_size);
+        return Layout::wire_size(payload_size);
+    }
+
+private:
+    unsigned char *frame_;
+};
+
+enum FrameStatus {
+    FRAME_OK,
+    FRAME_TRUNCATED,  // Datagram shorter than its header claims
+    FRAME_TOO_LONG,  // Length beyond what the layout allows
+    FRAME_CORRUPT  // Checksum mismatch
+};
+
+// Decoding view over a received datagram. Fields and payload are only
+// meaningful when status() is FRAME_OK.
+template <typename Layout>
+class FrameReader {
+public:
+    FrameReader(const unsigned char *frame, size_t size) : frame_(frame), payload_size_(0) {
+        if (size < Layout::min_size) {
+            status_ = FRAME_TRUNCATED;
+            return;
+        }
+        payload_size_ = PayloadLength<Layout>::load(frame);
+        if (payload_size_ > Layout::max_payload) {
+            status_ = FRAME_TOO_LONG;
+        } else if (Layout::wire_size(payload_size_) > size) {
+            status_ = FRAME_TRUNCATED;
+        } else {
+            status_ = Layout::intact(frame, payload_size_) ? FRAME_OK : FRAME_CORRUPT;
+        }
+        if (status_ != FRAME_OK) {
+            payload_size_ = 0;
+        }
+    }
+
+    FrameStatus status() const { return status_; }
+    bool ok() const { return status_ == FRAME_OK; }
+
+    template <typename F>
+    typename F::type get() const { return F::load(frame_); }
+
+    const unsigned char *payload() const { return frame_ + Layout::header_size; }
+    size_t payload_size() const { return payload_size_; }
+
+private:
+    const unsigned char *frame_;
+    size_t payload_size_;
+    FrameStatus status_;
+};
+
+#endif
@@ -0,0 +1,113 @@
+// packet_trace.h
+// Per-packet latency analysis shared by sendfile and recvfile: static
+// tracepoints, and kernel timestamps of datagrams through SO_TIMESTAMPING.
+#ifndef PACKET_TRACE_H
+#define PACKET_TRACE_H
+
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
+// USDT probes, the ELF notes <sys/sdt.h> emits: a nop plus a note saying
+// where its signed 64-bit arguments live
+#if defined(__x86_64__)
+#define TRACE_NOTE(provider, name, args)                                                     \
+    "990: nop\n"                                                                             \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n"                                            \
+    ".balign 4\n"                                                                            \
+    ".4byte 992f-991f, 994f-993f, 3\n"                                                       \
+    "991: .asciz \"stapsdt\"\n"                                                              \
+    "992: .balign 4\n"                                                                       \
+    "993: .8byte 990b\n"                                                                     \
+    ".8byte _.stapsdt.base\n"                                                                \
+    ".8byte 0\n"                                                                             \
+    ".asciz \"" #provider "\"\n"                                                             \
+    ".asciz \"" #name "\"\n"                                                                 \
+    ".asciz \"" args "\"\n"                                                                  \
+    "994: .balign 4\n"                                                                       \
+    ".popsection\n"                                                                          \
+    ".ifndef _.stapsdt.base\n"                                                               \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"                  \
+    ".weak _.stapsdt.base\n"                                                                 \
+    ".hidden _.stapsdt.base\n"                                                               \
+    "_.stapsdt.base: .space 1\n"                                                             \
+    ".size _.stapsdt.base, 1\n"                                                              \
+    ".popsection\n"                                                                          \
+    ".endif\n"
+#define TRACE_PROBE2(provider, name, a, b) \
+    __asm__ __volatile__(TRACE_NOTE(provider, name, "-8@%0 -8@%1") ::"nor"((int64_t)(a)), "nor"((int64_t)(b)))
+#define TRACE_PROBE3(provider, name, a, b, c)                                                                       \
+    __asm__ __volatile__(TRACE_NOTE(provider, name, "-8@%0 -8@%1 -8@%2") ::"nor"((int64_t)(a)), "nor"((int64_t)(b)), \
+                         "nor"((int64_t)(c)))
+#else
+#define TRACE_PROBE2(provider, name, a, b) ((void)0)
+#define TRACE_PROBE3(provider, name, a, b, c) ((void)0)
+#endif
+
+// Room for the drop counter and the timestamps next to a datagram
+#define TIMESTAMP_CONTROL_SIZE (CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(struct scm_timestamping)) + 64)
+
+// When the kernel and the NIC saw a datagram, ns, 0 when not stamped.
+// Software time is CLOCK_REALTIME; hardware time is the NIC's own clock
+// and only compares with other hardware timestamps.
+struct PacketTimes {
+    int64_t software = 0;
+    int64_t hardware = 0;
+};
+
+inline int64_t realtime_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+inline int64_t timespec_ns(const struct timespec &ts) { return ts.tv_sec * 1000000000LL + ts.tv_nsec; }
+
+// Ask for receive timestamps and, on a sending socket, transmit ones too:
+// on entering the qdisc, on leaving for the driver and from the NIC. Sent
+// datagrams are numbered from 0 and their timestamps come back on the error
+// queue under that number, without the payload.
+inline bool enable_timestamping(int sockfd, bool transmit) {
+    int flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RAW_HARDWARE | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_RX_HARDWARE;
+    if (transmit) {
+        flags |= SOF_TIMESTAMPING_TX_SCHED | SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_OPT_ID |
+                 SOF_TIMESTAMPING_OPT_TSONLY;
+    }
+    if (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+        perror("Failed to enable SO_TIMESTAMPING");
+        return false;
+    }
+    return true;
+}
+
+// Timestamps among a received message's control data
+inline PacketTimes packet_times(struct msghdr &msg) {
+    PacketTimes times;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            struct scm_timestamping stamps;
+            memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+            times.software = timespec_ns(stamps.ts[0]);
+            times.hardware = timespec_ns(stamps.ts[2]);
+        }
+    }
+    return times;
+}
+
+// One line on a latency: median, tail and worst of the samples, in us
+inline void report_spread(const char *what, std::vector<int64_t> &ns) {
+    if (ns.empty()) {
+        return;
+    }
+    std::sort(ns.begin(), ns.end());
+    std::cout << "  " << what << ": p50 " << ns[ns.size() / 2] / 1000.0 << " us, p99 " << ns[ns.size() * 99 / 100] / 1000.0 << " us, max "
+              << ns.back() / 1000.0 << " us (" << ns.size() << " frames)" << std::endl;
+}
+
+#endif
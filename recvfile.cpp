@@ -1,230 +1,1544 @@
-// recvfile.cpp
-#include <iostream>
-#include <fstream>
-#include <sys/socket.h>
-#include <arpa/inet.h>
-#include <unistd.h>
-#include <cstring>
-#include <getopt.h>
-#include <map>
-#include <sys/stat.h>
-
-using namespace std;
-
-#define MAX_DATA_SIZE 512  // Each frame carries up to 512 bytes
-#define MAX_FRAME_SIZE 522  // Frame size: headers + data + checksum
-#define ACK_SIZE 6
-#define WINDOW_SIZE 5  // Sliding window size
-
-enum PacketType {
-    FILENAME = 1,
-    FILEDATA = 2,
-    END_OF_TRANSFER = 3
-};
-
-// Simple checksum function
-unsigned char checksum(const unsigned char *frame, int count) {
-    unsigned long sum = 0;
-    while (count--) {
-        sum += *frame++;
-        if (sum & 0xFF00) {
-            sum &= 0xFF;
-            sum++;
-        }
-    }
-    return (unsigned char)(sum & 0xFF);
-}
-
-// Read data frame and verify checksum
-bool read_frame(PacketType &pkt_type, int &seq_num, unsigned char *data, int &data_size, const unsigned char *frame) {
-    pkt_type = static_cast<PacketType>(frame[0]);
-    uint32_t net_seq_num;
-    memcpy(&net_seq_num, frame + 1, 4);  // Read sequence number
-    seq_num = ntohl(net_seq_num);
-
-    uint32_t net_data_size;
-    memcpy(&net_data_size, frame + 5, 4);  // Read data size
-    data_size = ntohl(net_data_size);
-
-    memcpy(data, frame + 9, data_size);  // Read data
-    unsigned char received_checksum = frame[data_size + 9];
-    unsigned char calculated_checksum = checksum(frame, data_size + 9);
-
-    // Return true if checksum does not match
-    return received_checksum != calculated_checksum;
-}
-
-// Create ACK
-void create_ack(int seq_num, unsigned char *ack, bool error) {
-    ack[0] = error ? 0x0 : 0x1;
-    uint32_t net_seq_num = htonl(seq_num);
-    memcpy(ack + 1, &net_seq_num, 4);
-    ack[5] = checksum(ack, ACK_SIZE - 1);
-}
-
-// Create UDP socket
-int create_socket() {
-    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd < 0) {
-        perror("Socket creation failed");
-        exit(1);
-    }
-    return sockfd;
-}
-
-// Parse command line arguments
-void parse_arguments(int argc, char *argv[], int &recv_port) {
-    int opt;
-    while ((opt = getopt(argc, argv, "p:")) != -1) {
-        switch (opt) {
-        case 'p':
-            recv_port = atoi(optarg);
-            break;
-        default:
-            cerr << "Usage: recvfile -p <recv port>" << endl;
-            exit(1);
-        }
-    }
-}
-
-// Set up receiver address
-struct sockaddr_in setup_recv_addr(int recv_port) {
-    struct sockaddr_in recv_addr;
-    memset(&recv_addr, 0, sizeof(recv_addr));
-    recv_addr.sin_family = AF_INET;
-    recv_addr.sin_port = htons(recv_port);
-    recv_addr.sin_addr.s_addr = INADDR_ANY;
-    return recv_addr;
-}
-
-// Receive data and write to file
-void receive_data(int sockfd, struct sockaddr_in &sender_addr) {
-    unsigned char buffer[MAX_FRAME_SIZE];
-    unsigned char data[MAX_DATA_SIZE];
-    int expected_seq_num = 0;
-    map<int, pair<unsigned char *, int>> frame_buffer;
-
-    string filepath;
-    ofstream file;
-    bool filename_received = false;
-
-    bool receive_done = false;
-    while (!receive_done) {
-        socklen_t addr_len = sizeof(sender_addr);
-        int frame_size = recvfrom(sockfd, buffer, MAX_FRAME_SIZE, 0, (struct sockaddr *)&sender_addr, &addr_len);
-        if (frame_size < 0) {
-            perror("Failed to receive frame");
-            exit(1);
-        }
-
-        PacketType pkt_type;
-        int seq_num, data_size;
-        if (read_frame(pkt_type, seq_num, data, data_size, buffer)) {
-            cout << "[recv corrupt packet]" << endl;
-            continue;
-        }
-
-        // Send ACK
-        unsigned char ack[ACK_SIZE];
-        create_ack(seq_num, ack, false);
-        sendto(sockfd, ack, ACK_SIZE, 0, (struct sockaddr *)&sender_addr, addr_len);
-        cout << "Sending ACK for frame " << seq_num << endl;
-
-        if (pkt_type == FILENAME && !filename_received) {
-            // Receive filename and directory
-            filepath = string((char *)data, data_size) + ".recv";
-            cout << "Received file path: " << filepath << endl;
-
-            // Create directory if it doesn't exist
-            size_t last_slash = filepath.find_last_of('/');
-            if (last_slash != string::npos) {
-                string dir_path = filepath.substr(0, last_slash);
-                struct stat st = {0};
-                if (stat(dir_path.c_str(), &st) == -1) {
-                    mkdir(dir_path.c_str(), 0700);
-                }
-            }
-
-            // Open file for writing
-            file.open(filepath, ios::out | ios::binary);
-            if (!file.is_open()) {
-                cerr << "Error opening file for writing: " << filepath << endl;
-                exit(1);
-            }
-
-            filename_received = true;
-            expected_seq_num = seq_num + 1;
-        } else if (pkt_type == FILEDATA && filename_received) {
-            if (seq_num == expected_seq_num) {
-                // Write in-order frame to file
-                file.write((char *)data, data_size);
-                cout << "[recv data] seq_num " << seq_num << " ACCEPTED" << endl;
-                expected_seq_num++;
-
-                // Check if any buffered frames can be written
-                while (frame_buffer.count(expected_seq_num) > 0) {
-                    auto &buf_pair = frame_buffer[expected_seq_num];
-                    file.write((char *)buf_pair.first, buf_pair.second);
-                    delete[] buf_pair.first;
-                    frame_buffer.erase(expected_seq_num);
-                    cout << "[recv data] seq_num " << expected_seq_num << " ACCEPTED from buffer" << endl;
-                    expected_seq_num++;
-                }
-            } else if (seq_num > expected_seq_num) {
-                // Buffer out-of-order frame
-                unsigned char *buffered_data = new unsigned char[data_size];
-                memcpy(buffered_data, data, data_size);
-                frame_buffer[seq_num] = make_pair(buffered_data, data_size);
-                cout << "[recv data] seq_num " << seq_num << " BUFFERED" << endl;
-            } else {
-                // Duplicate frame, already received
-                cout << "[recv data] seq_num " << seq_num << " DUPLICATE" << endl;
-            }
-        } else if (pkt_type == END_OF_TRANSFER) {
-            cout << "End-of-Transfer packet received." << endl;
-            receive_done = true;
-
-            // Write any remaining buffered frames
-            while (frame_buffer.count(expected_seq_num) > 0) {
-                auto &buf_pair = frame_buffer[expected_seq_num];
-                file.write((char *)buf_pair.first, buf_pair.second);
-                delete[] buf_pair.first;
-                frame_buffer.erase(expected_seq_num);
-                cout << "[recv data] seq_num " << expected_seq_num << " ACCEPTED from buffer" << endl;
-                expected_seq_num++;
-            }
-        }
-    }
-
-    if (file.is_open()) {
-        file.close();
-    }
-}
-
-int main(int argc, char *argv[]) {
-    int recv_port = 0;
-
-    parse_arguments(argc, argv, recv_port);
-
-    if (recv_port == 0) {
-        cerr << "Usage: recvfile -p <recv port>" << endl;
-        return 1;
-    }
-
-    int sockfd = create_socket();
-
-    struct sockaddr_in recv_addr = setup_recv_addr(recv_port);
-
-    if (bind(sockfd, (struct sockaddr *)&recv_addr, sizeof(recv_addr)) < 0) {
-        perror("Bind failed");
-        close(sockfd);
-        return 1;
-    }
-
-    struct sockaddr_in sender_addr;
-    receive_data(sockfd, sender_addr);
-
-    close(sockfd);
-    cout << "[completed]" << endl;
-    return 0;
-}
+// recvfile.cpp
+#include <iostream>
+#include <fstream>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cstring>
+#include <getopt.h>
+#include <map>
+#include <sys/stat.h>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include <deque>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include "event_loop.h"
+#include "spsc_queue.h"
+#include "uring.h"
+#include "frame_codec.h"
+#include "frame_cipher.h"
+#include "chunk_store.h"
+#include "packet_trace.h"
+
+using namespace std;
+
+#define WINDOW_SIZE 5  // Sliding window size
+#define RECV_BUFFER_FRAMES 64  // Frames we can hold past the next expected one
+#define SKB_OVERHEAD 768  // Kernel bookkeeping charged per queued datagram
+#define WRITE_BLOCK_SIZE (64 * 1024)  // Size of each coalesced disk write
+#define WRITE_BEHIND_BLOCKS 8  // Blocks that may wait for the disk thread
+#define WRITE_ALIGN 4096  // O_DIRECT alignment of buffers, offsets and lengths
+#define WRITEBACK_BYTES (8 * 1024 * 1024)  // Buffered data between writeback starts
+#define URING_ENTRIES 256  // Submission queue depth of the network ring
+#define RECV_SLOTS 64  // Frame receives kept posted on the network ring
+#define ACK_SEND_SLOTS 64  // ACK sends that may be queued on the network ring
+#define VERIFY_QUEUE_FRAMES 256  // Frames the network thread may queue for the verifier
+#define PULL_OVERCOMMIT 4  // Transfers holding credit at once in pull mode
+#define TRANSFER_IDLE_MS 30000  // Forget a sender that has been silent this long
+#define LINGER_MS 5000  // Keep answering End-of-Transfer retransmissions this long, past the sender's MAX_RTO_MS
+#define CHUNK_STORE_MB 1024  // Default size of the chunk store
+#define REPEAT_HOLD_BYTES (64 * 1024 * 1024)  // Chunks a file may keep in memory for its later repeats
+
+// Create ACK carrying the acked seq_num, the next expected seq_num, the
+// number of frames we can still accept beyond it and the kernel drops seen
+// during this transfer; its size. With a cipher the ACK is sealed, its nonce
+// taken from counter, which must differ for every ACK.
+int create_ack(int seq_num, int next_expected, int window, uint32_t drops, unsigned char *ack, bool error,
+               FrameCipher *cipher, uint32_t counter) {
+    FrameWriter<AckFrame> out(ack);
+    out.set<AckFrame::Flag>(error ? ACK_ERROR : ACK_OK);
+    out.set<AckFrame::Seq>(seq_num);
+    out.set<AckFrame::NextExpected>(next_expected);
+    out.set<AckFrame::Window>(window);
+    out.set<AckFrame::Drops>(drops);
+    if (cipher) {
+        SealedAck::Counter::store(ack, counter);
+        cipher->seal<SealedAck>(ack, nullptr, 0, ACK_NONCE_KIND, counter);
+        return SealedAck::max_size;
+    }
+    return out.finish(0);
+}
+
+// Create the answer to a chunk query: an ACK that also carries one bit per
+// queried chunk, most significant first, set for those we lack
+int create_needs_ack(int seq_num, int next_expected, int window, uint32_t drops, const vector<unsigned char> &needs,
+                     unsigned char *ack, FrameCipher *cipher, uint32_t counter) {
+    if (cipher) {
+        FrameWriter<SealedNeedsAck> out(ack);
+        out.set<SealedNeedsAck::Flag>(ACK_NEEDS);
+        out.set<SealedNeedsAck::Seq>(seq_num);
+        out.set<SealedNeedsAck::NextExpected>(next_expected);
+        out.set<SealedNeedsAck::Window>(window);
+        out.set<SealedNeedsAck::Drops>(drops);
+        out.set<SealedNeedsAck::Counter>(counter);
+        int ack_size = out.finish(needs.size());
+        cipher->seal<SealedNeedsAck>(ack, needs.data(), needs.size(), ACK_NONCE_KIND, counter);
+        return ack_size;
+    }
+    FrameWriter<NeedsAck> out(ack);
+    out.set<NeedsAck::Flag>(ACK_NEEDS);
+    out.set<NeedsAck::Seq>(seq_num);
+    out.set<NeedsAck::NextExpected>(next_expected);
+    out.set<NeedsAck::Window>(window);
+    out.set<NeedsAck::Drops>(drops);
+    memcpy(out.payload(), needs.data(), needs.size());
+    return out.finish(needs.size());
+}
+
+// Block of in-order file data waiting for the disk thread
+struct WriteBlock {
+    unsigned char *data = nullptr;
+    int size = 0;
+    uint64_t skip = 0;  // Zero bytes that follow the data
+    bool last = false;  // Disk thread exits after writing it
+    uint64_t offset = 0;
+    int written = 0;
+};
+
+// What has to reach the disk before a file's End-of-Transfer is ACKed
+enum Durability {
+    DURABILITY_NONE,  // Nothing, the page cache writes it back some time
+    DURABILITY_FLUSH,  // Buffered writes, pushed out as they go and synced at the end
+    DURABILITY_DIRECT,  // O_DIRECT where aligned, synced at the end
+};
+
+// The disk end of an output file, with a second descriptor opened O_DIRECT
+// for aligned runs under DIRECT
+struct DiskFile {
+    int fd = -1;
+    int direct_fd = -1;
+    bool seekable = false;
+    Durability durability = DURABILITY_NONE;
+    uint64_t started = 0;  // Writeback started up to here
+    uint64_t dropped = 0;  // Gone from the page cache up to here
+
+    // Descriptor for a run of size bytes at offset
+    int fd_for(uint64_t offset, uint64_t size) const {
+        return direct_fd >= 0 && offset % WRITE_ALIGN == 0 && size % WRITE_ALIGN == 0 ? direct_fd : fd;
+    }
+
+    // Data up to end has been written. Under FLUSH writeback starts every
+    // WRITEBACK_BYTES and the step before leaves the page cache.
+    void written(uint64_t end) {
+        if (durability != DURABILITY_FLUSH || !seekable || end < started + WRITEBACK_BYTES) {
+            return;
+        }
+        sync_file_range(fd, started, end - started, SYNC_FILE_RANGE_WRITE);
+        if (started > dropped) {
+            sync_file_range(fd, dropped, started - dropped,
+                            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            posix_fadvise(fd, dropped, started - dropped, POSIX_FADV_DONTNEED);
+            dropped = started;
+        }
+        started = end;
+    }
+
+    // Truncate to size, as a file may end in a hole, and sync unless NONE
+    void finish(uint64_t size) {
+        if (!seekable) {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && (uint64_t)st.st_size < size && ftruncate(fd, size) < 0) {
+            perror("Failed to extend file");
+            exit(1);
+        }
+        if (durability == DURABILITY_NONE) {
+            return;
+        }
+        if (fdatasync(fd) < 0) {
+            perror("Failed to sync file");
+            exit(1);
+        }
+        posix_fadvise(fd, dropped, 0, POSIX_FADV_DONTNEED);
+    }
+};
+
+// Disk stage: write blocks as they fill up and hand them back. Blocks that
+// are ready together go out as one write at the file offset they follow
+// on from. Zeros after a block are skipped over, leaving a hole, unless the
+// output is a pipe.
+void write_behind(DiskFile &file, BufferPipe<WriteBlock> &pipe) {
+    static const unsigned char zeros[WRITE_BLOCK_SIZE] = {};
+    uint64_t offset = 0;
+    bool last = false;
+    while (!last) {
+        // A run ends with zeros to skip, at the last block or when no
+        // further block is ready
+        WriteBlock *run[WRITE_BEHIND_BLOCKS];
+        struct iovec iovs[WRITE_BEHIND_BLOCKS];
+        int count = 0;
+        uint64_t size = 0;
+        run[count++] = pipe.take_ready();
+        while (run[count - 1]->skip == 0 && !run[count - 1]->last && count < WRITE_BEHIND_BLOCKS && pipe.ready.pop(run[count])) {
+            count++;
+        }
+        for (int i = 0; i < count; i++) {
+            iovs[i].iov_base = run[i]->data;
+            iovs[i].iov_len = run[i]->size;
+            size += run[i]->size;
+        }
+
+        int fd = file.seekable ? file.fd_for(offset, size) : file.fd;
+        for (int first = 0; first < count;) {
+            ssize_t n = file.seekable ? pwritev(fd, iovs + first, count - first, offset) : writev(fd, iovs + first, count - first);
+            if (n < 0) {
+                perror("Failed to write file");
+                exit(1);
+            }
+            offset += n;
+            // A short write only means go on with the rest
+            for (; first < count && (size_t)n >= iovs[first].iov_len; first++) {
+                n -= iovs[first].iov_len;
+            }
+            if (first < count) {
+                iovs[first].iov_base = (unsigned char *)iovs[first].iov_base + n;
+                iovs[first].iov_len -= n;
+            }
+        }
+
+        WriteBlock *tail = run[count - 1];
+        for (uint64_t left = file.seekable ? 0 : tail->skip; left > 0;) {
+            ssize_t n = write(file.fd, zeros, min<uint64_t>(left, sizeof(zeros)));
+            if (n < 0) {
+                perror("Failed to write file");
+                exit(1);
+            }
+            left -= n;
+        }
+        offset += tail->skip;
+        file.written(offset);
+        last = tail->last;
+        for (int i = 0; i < count; i++) {
+            run[i]->size = 0;
+            run[i]->skip = 0;
+            pipe.put_free(run[i]);
+        }
+    }
+    file.finish(offset);
+}
+
+// Disk stage on io_uring: each ready block becomes a WRITE_FIXED from its
+// registered buffer at its own file offset, so several writes can be in
+// flight and a block returns to the pool as soon as its write completes.
+// Zeros after a block only move the next offset on.
+void write_behind_uring(IoUring &ring, DiskFile &file, BufferPipe<WriteBlock> &pipe, WriteBlock *blocks) {
+    struct iovec iovs[WRITE_BEHIND_BLOCKS];
+    for (int i = 0; i < WRITE_BEHIND_BLOCKS; i++) {
+        iovs[i].iov_base = blocks[i].data;
+        iovs[i].iov_len = WRITE_BLOCK_SIZE;
+    }
+    int fds[2] = {file.fd, file.direct_fd >= 0 ? file.direct_fd : file.fd};
+    if (!ring.register_buffers(iovs, WRITE_BEHIND_BLOCKS) || !ring.register_files(fds, 2)) {
+        perror("Failed to register write-behind buffers");
+        exit(1);
+    }
+
+    // Registered file 1 is the O_DIRECT descriptor, where there is one
+    auto submit_write = [&](WriteBlock *block) {
+        int index = block - blocks;
+        uint64_t offset = block->offset + block->written;
+        int size = block->size - block->written;
+        IoUring::prep_write_fixed(ring.get_sqe(), file.fd_for(offset, size) == file.fd ? 0 : 1, block->data + block->written, size,
+                                  offset, index, index);
+    };
+
+    uint64_t offset = 0;
+    int in_flight = 0;
+    bool last = false;
+    while (!last || in_flight > 0) {
+        WriteBlock *block;
+        while (!last && pipe.ready.pop(block)) {
+            block->offset = offset;
+            block->written = 0;
+            offset += block->size + block->skip;
+            block->skip = 0;
+            last = block->last;
+            if (block->size == 0) {
+                pipe.put_free(block);
+                continue;
+            }
+            submit_write(block);
+            in_flight++;
+        }
+        if (in_flight == 0) {
+            if (!last) {
+                pipe.ready_signal.wait();
+            }
+            continue;
+        }
+
+        ring.submit(1);
+        struct io_uring_cqe *cqe;
+        while ((cqe = ring.peek_cqe())) {
+            if (cqe->res < 0) {
+                errno = -cqe->res;
+                perror("Failed to write file");
+                exit(1);
+            }
+            WriteBlock *done = &blocks[cqe->user_data];
+            done->written += cqe->res;
+            ring.cqe_seen();
+            if (done->written < done->size) {
+                submit_write(done);  // Short write, queue the rest
+                continue;
+            }
+            file.written(done->offset + done->size);
+            done->size = 0;
+            in_flight--;
+            pipe.put_free(done);
+        }
+    }
+    file.finish(offset);
+    ring.unregister_buffers();
+    ring.unregister_files();
+}
+
+// Network-thread end of the write-behind stage. In-order frames are copied
+// into large blocks and only full blocks cross over to the disk thread, so
+// a slow write never delays the next recvfrom() or ACK.
+struct FileWriter {
+    DiskFile file;
+    IoUring *ring = nullptr;
+    BufferPipe<WriteBlock> pipe;
+    WriteBlock blocks[WRITE_BEHIND_BLOCKS];
+    WriteBlock *current = nullptr;
+    thread disk_thread;
+
+    FileWriter() : pipe(WRITE_BEHIND_BLOCKS) {
+        for (WriteBlock &pooled : blocks) {
+            pooled.data = static_cast<unsigned char *>(aligned_alloc(WRITE_ALIGN, WRITE_BLOCK_SIZE));
+            pipe.put_free(&pooled);
+        }
+    }
+
+    ~FileWriter() {
+        close();
+        for (WriteBlock &pooled : blocks) {
+            free(pooled.data);
+        }
+    }
+
+    // "-" is stdout. Pipes and terminals have no offsets, so they always get
+    // the plain write() stage, which keeps blocks in order, and cannot be
+    // synced. With a disk ring the blocks are written through it until
+    // close(). Where the file system refuses O_DIRECT the page cache is used.
+    bool open(const string &filepath, IoUring *disk_ring, Durability durability) {
+        ring = disk_ring;
+        file.fd = filepath == "-" ? dup(STDOUT_FILENO) : ::open(filepath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (file.fd < 0) {
+            return false;
+        }
+        file.seekable = lseek(file.fd, 0, SEEK_CUR) >= 0;
+        file.durability = durability;
+        file.started = file.dropped = 0;
+        if (durability == DURABILITY_DIRECT && filepath != "-") {
+            file.direct_fd = ::open(filepath.c_str(), O_WRONLY | O_DIRECT);
+            if (file.direct_fd < 0) {
+                perror("O_DIRECT unavailable, writing through the page cache");
+            }
+        }
+        for (WriteBlock &pooled : blocks) {
+            pooled.last = false;  // Still set on the previous file's final block
+        }
+        current = pipe.take_free();
+        disk_thread = ring && file.seekable ? thread(write_behind_uring, ref(*ring), ref(file), ref(pipe), blocks)
+                                            : thread(write_behind, ref(file), ref(pipe));
+        return true;
+    }
+
+    bool is_open() const { return current != nullptr; }
+
+    void write(const unsigned char *data, int size) {
+        while (size > 0) {
+            int chunk = min(size, WRITE_BLOCK_SIZE - current->size);
+            memcpy(current->data + current->size, data, chunk);
+            current->size += chunk;
+            data += chunk;
+            size -= chunk;
+            if (current->size == WRITE_BLOCK_SIZE) {
+                pipe.put_ready(current);
+                current = pipe.take_free();
+            }
+        }
+    }
+
+    // A run of zeros, left as a hole where the output can seek
+    void skip(uint64_t size) {
+        current->skip += size;
+        pipe.put_ready(current);
+        current = pipe.take_free();
+    }
+
+    // Flush the partial block and wait for the disk thread to finish, and
+    // with it the sync the durability policy asks for
+    void close() {
+        if (!is_open()) {
+            return;
+        }
+        current->last = true;
+        pipe.put_ready(current);
+        current = nullptr;
+        disk_thread.join();
+        ::close(file.fd);
+        file.fd = -1;
+        if (file.direct_fd >= 0) {
+            ::close(file.direct_fd);
+            file.direct_fd = -1;
+        }
+    }
+
+    // Frames the write-behind stage can still absorb
+    int free_frames() const {
+        if (!is_open()) {
+            return WRITE_BEHIND_BLOCKS * WRITE_BLOCK_SIZE / MAX_DATA_SIZE;
+        }
+        int free_bytes = pipe.free.size() * WRITE_BLOCK_SIZE + WRITE_BLOCK_SIZE - current->size;
+        return free_bytes / MAX_DATA_SIZE;
+    }
+};
+
+// Out-of-order frame kept until the gap before it fills
+struct BufferedFrame {
+    unsigned char *data = nullptr;
+    int size = 0;
+    PacketType type = FILEDATA;
+};
+
+// Manifest entry of a deduplicated file
+struct ManifestChunk {
+    ChunkHash hash;
+    uint32_t size = 0;
+    // STORED chunks are pinned in the store; a REPEAT copies the earlier
+    // NEEDED chunk with its hash, held by the transfer
+    enum { UNDECIDED, STORED, NEEDED, REPEAT } source = UNDECIDED;
+};
+
+// Chunk that repeats later in a deduplicated file, kept once assembled
+struct HeldChunk {
+    int waiting = 0;  // REPEAT entries not yet written
+    vector<unsigned char> data;
+};
+
+// One sender's files. Senders are told apart by source port, which stays
+// the same across the paths of a multipath sender and changes when a new
+// sender process starts its sequence space over.
+struct Transfer {
+    FileWriter writer;
+    int expected_seq_num = 0;
+    map<int, BufferedFrame> frame_buffer;
+    string filepath;
+    uint64_t file_size = 0;
+    long long bytes_received = 0;
+    int header_seq = -1;  // Of the file being received or last received
+    int sender_window = 0;  // From its session header, the most it can have in flight
+    int credit = 0;  // Frames granted past expected_seq_num, in pull mode
+    int advertised = 0;  // Window in the last ACK
+    struct sockaddr_in addr;  // Where ACKs go, the path last heard from
+    socklen_t addr_len = 0;
+    chrono::steady_clock::time_point last_heard;
+    vector<ManifestChunk> manifest;  // Empty unless the file is deduplicated
+    size_t assembled = 0;  // Manifest entries written out so far
+    map<ChunkHash, HeldChunk> held;  // NEEDED chunks, from their query until their last REPEAT is written
+    uint64_t held_bytes = 0;  // Reserved for chunks that have REPEATs waiting
+    vector<unsigned char> incoming;  // Received part of the chunk being assembled
+    long long bytes_from_store = 0;
+    long long bytes_repeated = 0;  // Copied from an earlier chunk of the file
+    long long bytes_as_holes = 0;  // Zero ranges, skipped rather than written
+    bool failed = false;  // Output is not the sender's file, End-of-Transfer is refused
+
+    ~Transfer() {
+        clear_buffer();
+    }
+
+    void clear_buffer() {
+        for (auto &buffered : frame_buffer) {
+            delete[] buffered.second.data;
+        }
+        frame_buffer.clear();
+    }
+
+    // Frames still to come, End-of-Transfer included; streams never run short
+    uint64_t remaining_frames() const {
+        if (file_size == SessionHeader::unknown_size) {
+            return UINT64_MAX;
+        }
+        uint64_t left = file_size > (uint64_t)bytes_received ? file_size - bytes_received : 0;
+        return (left + MAX_DATA_SIZE - 1) / MAX_DATA_SIZE + 1;
+    }
+};
+
+// Free buffer space to advertise, in frames. Every out-of-order frame we
+// hold shrinks the window, and so does a writer backlog, so a slow drain
+// pushes back on the sender instead of letting the socket buffer overflow.
+// budget is the whole receive window, or the transfer's credit in pull mode.
+int advertised_window(const Transfer &transfer, int budget) {
+    return max(0, min(budget - (int)transfer.frame_buffer.size(), transfer.writer.free_frames()));
+}
+
+// Pull mode: share the receive window out as credit, fewest remaining frames
+// first, among at most PULL_OVERCOMMIT transfers
+void grant_credits(map<in_port_t, Transfer *> &transfers, int budget) {
+    vector<Transfer *> active;
+    for (auto &entry : transfers) {
+        entry.second->credit = 0;
+        if (entry.second->writer.is_open()) {
+            active.push_back(entry.second);
+        }
+    }
+    stable_sort(active.begin(), active.end(),
+                [](const Transfer *a, const Transfer *b) { return a->remaining_frames() < b->remaining_frames(); });
+    int granted = min((int)active.size(), PULL_OVERCOMMIT);
+    for (int i = 0; i < granted; i++) {
+        int share = (budget + granted - i - 1) / (granted - i);
+        active[i]->credit = (int)min<uint64_t>(min(share, active[i]->sender_window), active[i]->remaining_frames());
+        budget -= active[i]->credit;
+    }
+}
+
+// Frames needed to cover a bandwidth-delay product
+int bdp_frames(double rate_mbps, double rtt_ms) {
+    double bdp_bytes = rate_mbps * 1e6 / 8 * rtt_ms / 1000;
+    return (int)(bdp_bytes / MAX_DATA_SIZE) + 1;
+}
+
+// Size a socket buffer, bypassing rmem_max/wmem_max when we are privileged
+int set_socket_buffer(int sockfd, int force_opt, int opt, int bytes) {
+    if (setsockopt(sockfd, SOL_SOCKET, force_opt, &bytes, sizeof(bytes)) < 0 &&
+        setsockopt(sockfd, SOL_SOCKET, opt, &bytes, sizeof(bytes)) < 0) {
+        perror("Failed to size socket buffer");
+    }
+    int actual = 0;
+    socklen_t len = sizeof(actual);
+    getsockopt(sockfd, SOL_SOCKET, opt, &actual, &len);
+    return actual;
+}
+
+// Create UDP socket that can queue a full advertised window and reports
+// kernel drops on every datagram
+int create_socket(int window) {
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0) {
+        perror("Socket creation failed");
+        exit(1);
+    }
+    int wanted = window * (MAX_FRAME_SIZE + SKB_OVERHEAD);
+    int actual = set_socket_buffer(sockfd, SO_RCVBUFFORCE, SO_RCVBUF, wanted);
+    cout << "Receive buffer " << actual << " bytes (wanted " << wanted << " for " << window << " frames)" << endl;
+
+    int on = 1;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) < 0) {
+        perror("Failed to enable SO_RXQ_OVFL");
+    }
+    return sockfd;
+}
+
+// Receive a frame without blocking, picking up the socket's kernel drop
+// counter and, when enabled, the frame's timestamps on the way
+int receive_frame(int sockfd, unsigned char *buffer, struct sockaddr_in &sender_addr, socklen_t &addr_len, uint32_t &kernel_drops,
+                  PacketTimes &times) {
+    struct iovec iov = {buffer, MAX_FRAME_SIZE};
+    char control[TIMESTAMP_CONTROL_SIZE];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &sender_addr;
+    msg.msg_namelen = addr_len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    int frame_size = recvmsg(sockfd, &msg, MSG_DONTWAIT);
+    addr_len = msg.msg_namelen;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+            memcpy(&kernel_drops, CMSG_DATA(cmsg), sizeof(uint32_t));
+        }
+    }
+    times = packet_times(msg);
+    return frame_size;
+}
+
+// Datagram I/O of the network thread. The classic path is recvmsg() and
+// sendto() per frame. With an io_uring, RECVMSG requests stay posted so
+// frames that arrive together are reaped in one batch, and ACKs are queued
+// as SENDMSG requests that go out together on flush().
+class RecvPath {
+public:
+    RecvPath(int sockfd, IoUring *ring) : sockfd_(sockfd), ring_(ring), completions_(true) {
+        if (!ring_) {
+            return;
+        }
+        if (!ring_->register_files(&sockfd_, 1) || !ring_->register_eventfd(completions_.fd())) {
+            perror("Failed to set up network ring");
+            exit(1);
+        }
+        for (int i = 0; i < ACK_SEND_SLOTS; i++) {
+            free_sends_.push_back(i);
+        }
+        for (int i = 0; i < RECV_SLOTS; i++) {
+            post_receive(i);
+        }
+    }
+
+    // Readable when frames may be waiting
+    int fd() const { return ring_ ? completions_.fd() : sockfd_; }
+
+    // Next frame without blocking: its size, or -1 once none are pending
+    int receive(unsigned char *buffer, struct sockaddr_in &sender_addr, socklen_t &addr_len, uint32_t &kernel_drops, PacketTimes &times) {
+        if (!ring_) {
+            int frame_size = receive_frame(sockfd_, buffer, sender_addr, addr_len, kernel_drops, times);
+            if (frame_size < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("Failed to receive frame");
+                exit(1);
+            }
+            return frame_size;
+        }
+        if (ready_.empty()) {
+            completions_.wait();
+            reap();
+        }
+        if (ready_.empty()) {
+            return -1;
+        }
+        int index = ready_.front().first;
+        int frame_size = ready_.front().second;
+        ready_.pop_front();
+        RecvSlot &slot = recv_slots_[index];
+        memcpy(buffer, slot.frame, frame_size);
+        memcpy(&sender_addr, &slot.addr, sizeof(slot.addr));
+        addr_len = slot.msg.msg_namelen;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&slot.msg); cmsg; cmsg = CMSG_NXTHDR(&slot.msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+                memcpy(&kernel_drops, CMSG_DATA(cmsg), sizeof(uint32_t));
+            }
+        }
+        times = packet_times(slot.msg);
+        post_receive(index);
+        return frame_size;
+    }
+
+    void send(const unsigned char *ack, int size, const struct sockaddr_in &addr, socklen_t addr_len) {
+        if (!ring_) {
+            sendto(sockfd_, ack, size, 0, (const struct sockaddr *)&addr, addr_len);
+            return;
+        }
+        while (free_sends_.empty()) {
+            ring_->submit(1);
+            reap();
+        }
+        int index = free_sends_.back();
+        free_sends_.pop_back();
+        SendSlot &slot = send_slots_[index];
+        memcpy(slot.ack, ack, size);
+        slot.addr = addr;
+        slot.iov.iov_base = slot.ack;
+        slot.iov.iov_len = size;
+        memset(&slot.msg, 0, sizeof(slot.msg));
+        slot.msg.msg_name = &slot.addr;
+        slot.msg.msg_namelen = addr_len;
+        slot.msg.msg_iov = &slot.iov;
+        slot.msg.msg_iovlen = 1;
+        IoUring::prep_sendmsg(ring_->get_sqe(), 0, &slot.msg, SEND_OP | index);
+    }
+
+    // Hand everything queued so far to the kernel
+    void flush() {
+        if (ring_) {
+            ring_->submit();
+        }
+    }
+
+    // Wait until every queued ACK has left
+    void drain() {
+        while (ring_ && free_sends_.size() < ACK_SEND_SLOTS) {
+            ring_->submit(1);
+            reap();
+        }
+    }
+
+private:
+    static const uint64_t SEND_OP = 1ULL << 32;
+
+    struct RecvSlot {
+        struct msghdr msg;
+        struct iovec iov;
+        struct sockaddr_in addr;
+        char control[TIMESTAMP_CONTROL_SIZE];
+        unsigned char frame[MAX_FRAME_SIZE];
+    };
+
+    struct SendSlot {
+        struct msghdr msg;
+        struct iovec iov;
+        struct sockaddr_in addr;
+        unsigned char ack[ACK_SIZE];
+    };
+
+    void post_receive(int index) {
+        RecvSlot &slot = recv_slots_[index];
+        slot.iov.iov_base = slot.frame;
+        slot.iov.iov_len = MAX_FRAME_SIZE;
+        memset(&slot.msg, 0, sizeof(slot.msg));
+        slot.msg.msg_name = &slot.addr;
+        slot.msg.msg_namelen = sizeof(slot.addr);
+        slot.msg.msg_iov = &slot.iov;
+        slot.msg.msg_iovlen = 1;
+        slot.msg.msg_control = slot.control;
+        slot.msg.msg_controllen = sizeof(slot.control);
+        IoUring::prep_recvmsg(ring_->get_sqe(), 0, &slot.msg, index);
+    }
+
+    void reap() {
+        struct io_uring_cqe *cqe;
+        while ((cqe = ring_->peek_cqe())) {
+            int index = cqe->user_data & 0xFFFFFFFF;
+            if (cqe->res < 0) {
+                errno = -cqe->res;
+                perror(cqe->user_data & SEND_OP ? "Failed to send ACK" : "Failed to receive frame");
+                exit(1);
+            }
+            if (cqe->user_data & SEND_OP) {
+                free_sends_.push_back(index);
+            } else {
+                ready_.push_back(make_pair(index, cqe->res));
+            }
+            ring_->cqe_seen();
+        }
+    }
+
+    int sockfd_;
+    IoUring *ring_;
+    QueueSignal completions_;
+    RecvSlot recv_slots_[RECV_SLOTS];
+    SendSlot send_slots_[ACK_SEND_SLOTS];
+    vector<int> free_sends_;
+    deque<pair<int, int>> ready_;
+};
+
+// Parse command line arguments
+void parse_arguments(int argc, char *argv[], int &recv_port, int &window, double &rate_mbps, double &rtt_ms, bool &use_uring, bool &sqpoll,
+                     bool &persistent, bool &pull, string &output, string &key_file, string &store_dir, long &store_mb,
+                     string &eviction, string &trace_file, string &durability) {
+    int opt;
+    while ((opt = getopt(argc, argv, "p:w:b:t:uUkPo:K:C:M:E:T:s:")) != -1) {
+        switch (opt) {
+        case 'p':
+            recv_port = atoi(optarg);
+            break;
+        case 'w':
+            window = atoi(optarg);
+            break;
+        case 'b':
+            rate_mbps = atof(optarg);
+            break;
+        case 't':
+            rtt_ms = atof(optarg);
+            break;
+        case 'U':
+            sqpoll = true;
+            // Fall through
+        case 'u':
+            use_uring = true;
+            break;
+        case 'k':
+            persistent = true;
+            break;
+        case 'P':
+            pull = true;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'K':
+            key_file = optarg;
+            break;
+        case 'C':
+            store_dir = optarg;
+            break;
+        case 'M':
+            store_mb = atol(optarg);
+            break;
+        case 'E':
+            eviction = optarg;
+            break;
+        case 'T':
+            trace_file = optarg;
+            break;
+        case 's':
+            durability = optarg;
+            break;
+        default:
+            cerr << "Usage: recvfile -p <recv port> [-w <window frames>] [-b <Mbit/s> -t <rtt ms>] [-u | -U] [-k] [-P] [-o <output> | -] [-K <key file>] [-C <chunk store dir> [-M <MB>] [-E lru | fifo]] [-T <trace file>] [-s none | flush | direct]" << endl;
+            exit(1);
+        }
+    }
+}
+
+// Set up receiver address
+struct sockaddr_in setup_recv_addr(int recv_port) {
+    struct sockaddr_in recv_addr;
+    memset(&recv_addr, 0, sizeof(recv_addr));
+    recv_addr.sin_family = AF_INET;
+    recv_addr.sin_port = htons(recv_port);
+    recv_addr.sin_addr.s_addr = INADDR_ANY;
+    return recv_addr;
+}
+
+// Frame taken off the socket by the network thread
+struct ReceivedFrame {
+    unsigned char frame[MAX_FRAME_SIZE];
+    int size = 0;
+    uint32_t kernel_drops = 0;
+    struct sockaddr_in addr;
+    socklen_t addr_len = 0;
+    chrono::steady_clock::time_point received;
+    PacketTimes times;  // Only stamped under -T
+    int64_t read_ns = 0;  // When the network thread took it, under -T
+    bool last = false;  // No frame, the network thread is done lingering
+};
+
+// Per-frame timing for -T, one CSV row per frame keyed by the sender's
+// port and seq_num so it joins with the sender's trace
+class PacketLog {
+public:
+    explicit PacketLog(const string &path) : path_(path) {}
+
+    void record(const ReceivedFrame &frame, int type, int seq) {
+        Arrival arrival;
+        arrival.port = ntohs(frame.addr.sin_port);
+        arrival.type = type;
+        arrival.seq = seq;
+        arrival.times = frame.times;
+        arrival.read_ns = frame.read_ns;
+        arrival.verify_ns = realtime_ns();
+        log_.push_back(arrival);
+    }
+
+    // Write the log out and say where the time went
+    void report() {
+        ofstream out(path_);
+        out << "port,seq,type,nic_ns,kernel_ns,read_ns,verify_ns\n";
+        vector<int64_t> in_socket, in_queue;
+        size_t nic_stamped = 0;
+        for (const Arrival &arrival : log_) {
+            out << arrival.port << ',' << arrival.seq << ',' << arrival.type << ',' << arrival.times.hardware << ',' << arrival.times.software
+                << ',' << arrival.read_ns << ',' << arrival.verify_ns << '\n';
+            nic_stamped += arrival.times.hardware != 0;
+            if (arrival.times.software) {
+                in_socket.push_back(arrival.read_ns - arrival.times.software);
+            }
+            in_queue.push_back(arrival.verify_ns - arrival.read_ns);
+        }
+        cout << "Trace: " << log_.size() << " frames, " << nic_stamped << " with NIC timestamps, in " << path_ << endl;
+        report_spread("waiting in socket", in_socket);
+        report_spread("network thread to verifier", in_queue);
+    }
+
+private:
+    struct Arrival {
+        int port = 0;
+        int type = 0;
+        int seq = 0;
+        PacketTimes times;
+        int64_t read_ns = 0;
+        int64_t verify_ns = 0;
+    };
+
+    string path_;
+    vector<Arrival> log_;
+};
+
+// ACK built by the verifier, for the network thread to send
+struct PendingAck {
+    unsigned char ack[ACK_SIZE];
+    int size = 0;
+    struct sockaddr_in addr;
+    socklen_t addr_len = 0;
+    chrono::steady_clock::time_point received;  // Of the frame it answers
+    bool last = false;  // Answers the End-of-Transfer frame
+};
+
+// Verifier stage: check and order frames, feed the writers and queue an
+// ACK for every frame, off the network thread
+long long verify_frames(BufferPipe<ReceivedFrame> &frames, BufferPipe<PendingAck> &acks, IoUring *disk_ring, int max_window, bool persistent,
+                        bool pull, const string &output, const unsigned char *key, ChunkStore *store, PacketLog *trace,
+                        Durability durability) {
+    FrameCipher *cipher = key ? new FrameCipher(key, preferred_suite()) : nullptr;
+    uint32_t acks_sealed = 0;
+    int recv_window = max_window;
+    uint32_t kernel_drops = 0, drops_at_start = 0, drops_seen = 0;
+    bool first_frame = true;
+
+    map<in_port_t, Transfer *> transfers;
+    Transfer *ring_owner = nullptr;  // The disk ring serves one writer at a time
+    int open_files = 0;
+    long long total_bytes = 0;
+    auto last_sweep = chrono::steady_clock::now();
+
+    // Write out the stored chunks from the next manifest entry on, up to
+    // the next one still to be received
+    auto write_stored = [&](Transfer &transfer) {
+        vector<unsigned char> chunk;
+        while (transfer.assembled < transfer.manifest.size() && (transfer.manifest[transfer.assembled].source == ManifestChunk::STORED ||
+                                                                  transfer.manifest[transfer.assembled].source == ManifestChunk::REPEAT)) {
+            ManifestChunk &entry = transfer.manifest[transfer.assembled++];
+            if (entry.source == ManifestChunk::REPEAT) {
+                HeldChunk &earlier = transfer.held[entry.hash];
+                transfer.writer.write(earlier.data.data(), earlier.data.size());
+                transfer.bytes_received += earlier.data.size();
+                transfer.bytes_repeated += earlier.data.size();
+                if (--earlier.waiting == 0) {
+                    transfer.held_bytes -= entry.size;
+                    transfer.held.erase(entry.hash);
+                }
+                continue;
+            }
+            if (!store->read(entry.hash, chunk)) {
+                cerr << "Chunk " << entry.hash.hex() << " missing from the store" << endl;
+                transfer.failed = true;
+                continue;
+            }
+            transfer.writer.write(chunk.data(), chunk.size());
+            transfer.bytes_received += chunk.size();
+            transfer.bytes_from_store += chunk.size();
+        }
+    };
+
+    // Data of a deduplicated file fills its needed chunks in turn; each is
+    // written through and, once whole and matching its hash, kept in the
+    // store
+    auto deliver_chunks = [&](Transfer &transfer, const unsigned char *data, int size) {
+        while (size > 0) {
+            write_stored(transfer);
+            if (transfer.assembled == transfer.manifest.size()) {
+                cerr << "Received data beyond the end of the manifest" << endl;
+                return;
+            }
+            ManifestChunk &entry = transfer.manifest[transfer.assembled];
+            int part = min<int>(size, entry.size - transfer.incoming.size());
+            transfer.incoming.insert(transfer.incoming.end(), data, data + part);
+            transfer.writer.write(data, part);
+            transfer.bytes_received += part;
+            data += part;
+            size -= part;
+            if (transfer.incoming.size() < entry.size) {
+                break;
+            }
+            if (store && hash_chunk(transfer.incoming.data(), entry.size) == entry.hash) {
+                store->put(entry.hash, transfer.incoming.data(), entry.size);
+            } else if (store) {
+                cerr << "Chunk " << entry.hash.hex() << " does not match its hash, not stored" << endl;
+            }
+            // Kept as received for the repeats that follow, if any
+            auto held = transfer.held.find(entry.hash);
+            if (held != transfer.held.end() && held->second.waiting > 0) {
+                held->second.data = transfer.incoming;
+            } else if (held != transfer.held.end()) {
+                transfer.held.erase(held);
+            }
+            transfer.incoming.clear();
+            transfer.assembled++;
+        }
+        write_stored(transfer);
+    };
+
+    // Take an in-order payload: manifest entries, file data or a zero range
+    auto deliver = [&](Transfer &transfer, PacketType type, const unsigned char *data, int size) {
+        if (type == CHUNK_MANIFEST) {
+            for (int pos = 0; pos + (int)ManifestEntry::size <= size; pos += ManifestEntry::size) {
+                ManifestChunk entry;
+                memcpy(entry.hash.bytes, data + pos, ManifestEntry::hash_size);
+                entry.size = ManifestEntry::Size::load(data + pos);
+                if (entry.size > 0) {
+                    transfer.manifest.push_back(entry);
+                }
+            }
+        } else if (type == ZERO_RANGE && size < (int)ZeroRange::size) {
+            cerr << "Malformed zero range, skipped" << endl;
+        } else if (type == ZERO_RANGE && transfer.manifest.empty()) {
+            uint64_t length = ZeroRange::Length::load(data);
+            transfer.writer.skip(length);
+            transfer.bytes_received += length;
+            transfer.bytes_as_holes += length;
+        } else if (type == ZERO_RANGE) {
+            // Zeros among the chunks are assembled like any other data
+            static const unsigned char zeros[WRITE_BLOCK_SIZE] = {};
+            for (uint64_t left = ZeroRange::Length::load(data); left > 0; left -= min<uint64_t>(left, sizeof(zeros))) {
+                deliver_chunks(transfer, zeros, min<uint64_t>(left, sizeof(zeros)));
+            }
+        } else if (transfer.manifest.empty()) {
+            transfer.writer.write(data, size);
+            transfer.bytes_received += size;
+        } else {
+            deliver_chunks(transfer, data, size);
+        }
+    };
+
+    // Write out buffered frames that are now in order
+    auto deliver_buffered = [&](Transfer &transfer) {
+        int &expected_seq_num = transfer.expected_seq_num;
+        while (transfer.frame_buffer.count(expected_seq_num) > 0) {
+            BufferedFrame &buffered = transfer.frame_buffer[expected_seq_num];
+            deliver(transfer, buffered.type, buffered.data, buffered.size);
+            TRACE_PROBE3(recvfile, frame_accept, expected_seq_num, buffered.size, ntohs(transfer.addr.sin_port));
+            delete[] buffered.data;
+            transfer.frame_buffer.erase(expected_seq_num);
+            cout << "[recv data] seq_num " << expected_seq_num << " ACCEPTED from buffer" << endl;
+            expected_seq_num++;
+        }
+    };
+
+    // Queue an ACK for the network thread, the answer to a chunk query when
+    // needs is given; the window it advertises
+    auto queue_ack = [&](Transfer &transfer, int ack_seq_num, chrono::steady_clock::time_point received, bool last,
+                         const vector<unsigned char> *needs, bool error) {
+        PendingAck *pending = acks.take_free();
+        int window = advertised_window(transfer, pull ? transfer.credit : recv_window);
+        if (needs) {
+            pending->size = create_needs_ack(ack_seq_num, transfer.expected_seq_num, window, kernel_drops - drops_at_start, *needs,
+                                             pending->ack, cipher, acks_sealed++);
+        } else {
+            pending->size = create_ack(ack_seq_num, transfer.expected_seq_num, window, kernel_drops - drops_at_start, pending->ack,
+                                       error, cipher, acks_sealed++);
+        }
+        pending->addr = transfer.addr;
+        pending->addr_len = transfer.addr_len;
+        pending->received = received;
+        pending->last = last;
+        acks.put_ready(pending);
+        transfer.advertised = window;
+        return window;
+    };
+
+    auto close_file = [&](Transfer &transfer) {
+        if (!transfer.writer.is_open()) {
+            return;
+        }
+        transfer.writer.close();
+        open_files--;
+        if (ring_owner == &transfer) {
+            ring_owner = nullptr;
+        }
+        for (ManifestChunk &entry : transfer.manifest) {
+            if (entry.source == ManifestChunk::STORED) {
+                store->release(entry.hash);
+            }
+        }
+        transfer.manifest.clear();
+        transfer.held.clear();
+        transfer.held_bytes = 0;
+        transfer.assembled = 0;
+        transfer.incoming.clear();
+    };
+
+    bool receive_done = false;
+    while (true) {
+        ReceivedFrame *received = frames.take_ready();
+        if (received->last) {
+            frames.put_free(received);
+            break;
+        }
+        unsigned char *buffer = received->frame;
+        int frame_size = received->size;
+        kernel_drops = received->kernel_drops;
+        if (first_frame) {
+            drops_at_start = drops_seen = kernel_drops;
+            first_frame = false;
+        }
+        if (kernel_drops > drops_seen) {
+            recv_window = max(1, recv_window / 2);
+            cout << "[kernel drops] " << kernel_drops - drops_seen << " frames, window " << recv_window << endl;
+            drops_seen = kernel_drops;
+        }
+
+        // Header fields and payload are read in place. A sealed frame is
+        // authenticated and decrypted first, its header fields sit where the
+        // plain layout has them.
+        const unsigned char *data;
+        int data_size;
+        bool intact;
+        if (cipher) {
+            FrameReader<SealedFrame> frame(buffer, frame_size);
+            intact = frame.ok() && cipher->open<SealedFrame>(buffer, frame.payload_size(), frame.get<SealedFrame::Type>(),
+                                                             frame.get<SealedFrame::Seq>());
+            data = frame.payload();
+            data_size = frame.payload_size();
+        } else {
+            FrameReader<DataFrame> frame(buffer, frame_size);
+            intact = frame.ok();
+            data = frame.payload();
+            data_size = frame.payload_size();
+        }
+        if (!intact) {
+            cout << "[recv corrupt packet]" << endl;
+            frames.put_free(received);
+            continue;
+        }
+        PacketType pkt_type = static_cast<PacketType>(DataFrame::Type::load(buffer));
+        int seq_num = DataFrame::Seq::load(buffer);
+        if (trace) {
+            trace->record(*received, pkt_type, seq_num);
+        }
+        if (receive_done && pkt_type != END_OF_TRANSFER) {
+            // Done, only a lost End-of-Transfer ACK still needs answering
+            frames.put_free(received);
+            continue;
+        }
+
+        Transfer *&slot = transfers[received->addr.sin_port];
+        if (!slot) {
+            slot = new Transfer;
+        }
+        Transfer &transfer = *slot;
+        transfer.addr = received->addr;
+        transfer.addr_len = received->addr_len;
+        transfer.last_heard = received->received;
+        int &expected_seq_num = transfer.expected_seq_num;
+        FileWriter &writer = transfer.writer;
+
+        int ack_seq_num = seq_num;
+        bool send_ack = true, file_done = false, refuse = false;
+        vector<unsigned char> needs;
+        bool answer_query = false;
+        if (pkt_type == FILENAME && !writer.is_open() && seq_num != transfer.header_seq && data_size >= (int)SessionHeader::size &&
+            !output.empty() && open_files > 0) {
+            // The output is taken; without an ACK the sender tries again later
+            cout << "[recv header] seq_num " << seq_num << " WAITING, output busy" << endl;
+            send_ack = false;
+        } else if (pkt_type == FILENAME && !writer.is_open() && seq_num != transfer.header_seq && data_size >= (int)SessionHeader::size) {
+            // Session header: path, size and the sender's window
+            if (seq_num != expected_seq_num) {
+                // A sender we join midway, start over in its sequence space
+                transfer.clear_buffer();
+            }
+            transfer.header_seq = seq_num;
+            transfer.bytes_received = 0;
+            transfer.bytes_from_store = 0;
+            transfer.bytes_repeated = 0;
+            transfer.bytes_as_holes = 0;
+            transfer.failed = false;
+            transfer.file_size = SessionHeader::FileSize::load(data);
+            transfer.sender_window = SessionHeader::Window::load(data);
+            string &filepath = transfer.filepath;
+            filepath = string((char *)data + SessionHeader::size, data_size - SessionHeader::size) + ".recv";
+            cout << "Received file path: " << filepath << " (";
+            if (transfer.file_size == SessionHeader::unknown_size) {
+                cout << "streamed";
+            } else {
+                cout << transfer.file_size << " bytes";
+            }
+            cout << ", sender window " << transfer.sender_window << ", port " << ntohs(received->addr.sin_port) << ")" << endl;
+            if (!output.empty()) {
+                filepath = output;
+            }
+
+            // Create directory if it doesn't exist
+            size_t last_slash = filepath.find_last_of('/');
+            if (output.empty() && last_slash != string::npos) {
+                string dir_path = filepath.substr(0, last_slash);
+                struct stat st = {0};
+                if (stat(dir_path.c_str(), &st) == -1) {
+                    mkdir(dir_path.c_str(), 0700);
+                }
+            }
+
+            // Open file for writing
+            IoUring *ring = ring_owner ? nullptr : disk_ring;
+            if (!writer.open(filepath, ring, durability)) {
+                cerr << "Error opening file for writing: " << filepath << endl;
+                exit(1);
+            }
+            if (ring) {
+                ring_owner = &transfer;
+            }
+            open_files++;
+
+            // Data that raced ahead of the header is waiting in the buffer
+            expected_seq_num = seq_num + 1;
+            deliver_buffered(transfer);
+        } else if (pkt_type == FILENAME) {
+            // Header retransmission, already handled
+            cout << "[recv header] seq_num " << seq_num << " DUPLICATE" << endl;
+        } else if ((pkt_type == FILEDATA || pkt_type == CHUNK_MANIFEST || pkt_type == ZERO_RANGE) && !writer.is_open() &&
+                   (seq_num <= expected_seq_num || seq_num >= expected_seq_num + max_window)) {
+            // Between files only data racing ahead of the next header is
+            // kept; anything else may belong to another sequence space, and
+            // a cumulative ACK for it could tell that sender it was delivered
+            send_ack = false;
+        } else if (pkt_type == FILEDATA || pkt_type == CHUNK_MANIFEST || pkt_type == ZERO_RANGE) {
+            if (seq_num == expected_seq_num) {
+                // Write in-order frame to file
+                deliver(transfer, pkt_type, data, data_size);
+                TRACE_PROBE3(recvfile, frame_accept, seq_num, data_size, ntohs(transfer.addr.sin_port));
+                cout << "[recv data] seq_num " << seq_num << " ACCEPTED" << endl;
+                expected_seq_num++;
+                recv_window = min(recv_window + 1, max_window);
+
+                // Check if any buffered frames can be written
+                deliver_buffered(transfer);
+            } else if (seq_num >= expected_seq_num + max_window) {
+                // Sender overran the advertised window, no room to keep it
+                cout << "[recv data] seq_num " << seq_num << " DROPPED (window full)" << endl;
+                ack_seq_num = expected_seq_num - 1;
+            } else if (seq_num > expected_seq_num && transfer.frame_buffer.count(seq_num) == 0) {
+                // Buffer out-of-order frame, including data ahead of the header
+                unsigned char *buffered_data = new unsigned char[data_size];
+                memcpy(buffered_data, data, data_size);
+                transfer.frame_buffer[seq_num] = BufferedFrame{buffered_data, data_size, pkt_type};
+                TRACE_PROBE3(recvfile, frame_buffer, seq_num, data_size, ntohs(transfer.addr.sin_port));
+                cout << "[recv data] seq_num " << seq_num << " BUFFERED" << endl;
+            } else {
+                // Duplicate frame, already received
+                cout << "[recv data] seq_num " << seq_num << " DUPLICATE" << endl;
+            }
+        } else if (pkt_type == CHUNK_QUERY && writer.is_open() && seq_num <= expected_seq_num && data_size >= (int)ChunkQuery::size) {
+            // The sender only asks once everything before is acked, so a
+            // query is either next in order or a repeat whose answer was
+            // lost; a repeat gets the same answer again
+            uint64_t first = ChunkQuery::First::load(data), count = ChunkQuery::Count::load(data);
+            if (first + count > transfer.manifest.size() || count > ChunkQuery::max_count) {
+                cerr << "Chunk query beyond the end of the manifest" << endl;
+                ack_seq_num = expected_seq_num - 1;
+            } else {
+                if (seq_num == expected_seq_num) {
+                    // A chunk that repeats an earlier NEEDED one is only sent
+                    // once, as long as holding that one fits REPEAT_HOLD_BYTES
+                    for (uint64_t i = first; i < first + count; i++) {
+                        ManifestChunk &entry = transfer.manifest[i];
+                        auto held = transfer.held.find(entry.hash);
+                        if (store && store->acquire(entry.hash)) {
+                            entry.source = ManifestChunk::STORED;
+                        } else if (held != transfer.held.end() &&
+                                   (held->second.waiting > 0 || transfer.held_bytes + entry.size <= REPEAT_HOLD_BYTES)) {
+                            entry.source = ManifestChunk::REPEAT;
+                            if (held->second.waiting++ == 0) {
+                                transfer.held_bytes += entry.size;
+                            }
+                        } else {
+                            entry.source = ManifestChunk::NEEDED;
+                            transfer.held.insert(make_pair(entry.hash, HeldChunk()));
+                        }
+                    }
+                    expected_seq_num++;
+                    write_stored(transfer);
+                }
+                needs.assign((count + 7) / 8, 0);
+                int needed = 0;
+                for (uint64_t i = 0; i < count; i++) {
+                    if (transfer.manifest[first + i].source == ManifestChunk::NEEDED) {
+                        needs[i / 8] |= 0x80 >> (i % 8);
+                        needed++;
+                    }
+                }
+                answer_query = true;
+                cout << "[recv query] seq_num " << seq_num << ", " << needed << " of " << count << " chunks needed" << endl;
+            }
+        } else if (pkt_type == WINDOW_PROBE) {
+            // Only answer with the current window
+            ack_seq_num = expected_seq_num - 1;
+        } else if (pkt_type == END_OF_TRANSFER && writer.is_open() && seq_num >= expected_seq_num) {
+            cout << "End-of-Transfer packet received." << endl;
+            file_done = true;
+
+            // Write any remaining buffered frames
+            deliver_buffered(transfer);
+            write_stored(transfer);
+            expected_seq_num = seq_num + 1;
+            if (transfer.file_size != SessionHeader::unknown_size && (uint64_t)transfer.bytes_received != transfer.file_size) {
+                cerr << "Received " << transfer.bytes_received << " bytes, session header announced " << transfer.file_size << endl;
+                transfer.failed = true;
+            }
+            refuse = transfer.failed;
+            receive_done = !persistent && open_files == 1;
+        } else if (pkt_type == END_OF_TRANSFER) {
+            // Our ACK for it was lost, answer the retransmission the same way
+            cout << "End-of-Transfer packet DUPLICATE" << endl;
+            refuse = transfer.failed && seq_num == expected_seq_num - 1;
+        }
+
+        if (!send_ack) {
+            frames.put_free(received);
+            continue;
+        }
+
+        // A file that must be on disk first is finished before its ACK;
+        // otherwise the ACK goes first, and finishing cannot delay it
+        if (file_done && durability != DURABILITY_NONE) {
+            close_file(transfer);
+        }
+
+        // Queue the ACK for the network thread
+        if (pull) {
+            grant_credits(transfers, recv_window);
+        }
+        int window = queue_ack(transfer, ack_seq_num, received->received, receive_done, answer_query ? &needs : nullptr, refuse);
+        cout << "Sending ACK for frame " << ack_seq_num << " (window " << window << ")" << endl;
+
+        if (file_done && transfer.failed) {
+            // Refused, so no copy that only looks complete is left behind
+            close_file(transfer);
+            if (transfer.filepath != "-") {
+                unlink(transfer.filepath.c_str());
+            }
+            cerr << "File rejected: " << transfer.filepath << endl;
+        } else if (file_done) {
+            close_file(transfer);
+            total_bytes += transfer.bytes_received;
+            cout << "File received: " << transfer.filepath << " (" << transfer.bytes_received << " bytes";
+            if (transfer.bytes_from_store > 0) {
+                cout << ", " << transfer.bytes_from_store << " from the chunk store";
+            }
+            if (transfer.bytes_repeated > 0) {
+                cout << ", " << transfer.bytes_repeated << " repeated within the file";
+            }
+            if (transfer.bytes_as_holes > 0) {
+                cout << ", " << transfer.bytes_as_holes << " left as holes";
+            }
+            cout << ")" << endl;
+            if (pull) {
+                grant_credits(transfers, recv_window);  // Its credit goes to the others
+            }
+        }
+
+        // Senders waiting for credit only hear from us when it is granted
+        if (pull && !receive_done) {
+            for (auto &entry : transfers) {
+                Transfer &waiting = *entry.second;
+                if (&waiting != &transfer && waiting.advertised == 0 && waiting.writer.is_open() &&
+                    advertised_window(waiting, waiting.credit) > 0) {
+                    window = queue_ack(waiting, waiting.expected_seq_num - 1, received->received, false, nullptr, false);
+                    cout << "[grant] port " << ntohs(entry.first) << " window " << window << endl;
+                }
+            }
+        }
+        frames.put_free(received);
+
+        // Forget senders that went away, giving up on their partial files
+        auto now = chrono::steady_clock::now();
+        if (now - last_sweep > chrono::milliseconds(TRANSFER_IDLE_MS / 10)) {
+            last_sweep = now;
+            for (auto it = transfers.begin(); it != transfers.end();) {
+                Transfer *idle = it->second;
+                if (now - idle->last_heard < chrono::milliseconds(TRANSFER_IDLE_MS)) {
+                    ++it;
+                    continue;
+                }
+                if (idle->writer.is_open()) {
+                    cout << "Sender on port " << ntohs(it->first) << " went silent, abandoning " << idle->filepath << endl;
+                    close_file(*idle);
+                }
+                delete idle;
+                it = transfers.erase(it);
+            }
+        }
+    }
+
+    cout << "Kernel dropped " << kernel_drops - drops_at_start << " frames during transfer" << endl;
+    for (auto &entry : transfers) {
+        close_file(*entry.second);
+        delete entry.second;
+    }
+    delete cipher;
+    return total_bytes;
+}
+
+// Receive data and write to file; this thread only moves datagrams to the
+// verifier and its ACKs back out
+long long receive_data(RecvPath &net, IoUring *disk_ring, int max_window, bool persistent, bool pull, const string &output,
+                       const unsigned char *key, ChunkStore *store, PacketLog *trace, Durability durability) {
+    BufferPipe<ReceivedFrame> frames(VERIFY_QUEUE_FRAMES);
+    BufferPipe<PendingAck> acks(VERIFY_QUEUE_FRAMES);
+    vector<ReceivedFrame> frame_pool(VERIFY_QUEUE_FRAMES);
+    vector<PendingAck> ack_pool(VERIFY_QUEUE_FRAMES);
+    for (int i = 0; i < VERIFY_QUEUE_FRAMES; i++) {
+        frames.put_free(&frame_pool[i]);
+        acks.put_free(&ack_pool[i]);
+    }
+    frames.free_signal.wait();
+    acks.free_signal.wait();
+
+    long long bytes_received = 0;
+    thread verifier([&]() {
+        bytes_received = verify_frames(frames, acks, disk_ring, max_window, persistent, pull, output, key, store, trace, durability);
+    });
+
+    EventLoop loop;
+    vector<double> ack_latency_us;
+    bool socket_watched = false;
+    uint32_t kernel_drops = 0;  // Only reported once it is non-zero
+    ReceivedFrame *spare = nullptr;  // Taken from free but not filled yet
+
+    auto on_socket = [&](uint32_t) {
+        ReceivedFrame *slot;
+        while ((slot = spare) || frames.free.pop(slot)) {
+            spare = nullptr;
+            slot->addr_len = sizeof(slot->addr);
+            slot->size = net.receive(slot->frame, slot->addr, slot->addr_len, kernel_drops, slot->times);
+            if (slot->size < 0) {
+                // The verifier is the only producer on free, pushing it back
+                // from here could hand the same slot out twice
+                spare = slot;
+                return;
+            }
+            slot->kernel_drops = kernel_drops;
+            slot->received = chrono::steady_clock::now();
+            slot->read_ns = slot->times.software ? realtime_ns() : 0;
+            slot->last = false;
+            frames.put_ready(slot);
+        }
+        // Verifier is behind: stop reading until it hands a slot back
+        loop.unwatch(net.fd());
+        socket_watched = false;
+    };
+    auto watch_socket = [&]() {
+        loop.watch(net.fd(), EPOLLIN, on_socket);
+        socket_watched = true;
+    };
+
+    loop.watch(frames.free_signal.fd(), EPOLLIN, [&](uint32_t) {
+        frames.free_signal.wait();
+        if (!socket_watched) {
+            watch_socket();
+            on_socket(EPOLLIN);  // Completions may already be waiting
+        }
+    });
+    // The last ACK may be lost, so the sender is answered until it has
+    // been quiet for LINGER_MS; then the verifier is told to finish
+    Timer linger;
+    linger.callback = [&]() {
+        ReceivedFrame *slot = spare ? spare : frames.take_free();
+        spare = nullptr;
+        slot->last = true;
+        frames.put_ready(slot);
+        loop.stop();
+    };
+    loop.watch(acks.ready_signal.fd(), EPOLLIN, [&](uint32_t) {
+        acks.ready_signal.wait();
+        PendingAck *pending;
+        while (acks.ready.pop(pending)) {
+            net.send(pending->ack, pending->size, pending->addr, pending->addr_len);
+            ack_latency_us.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - pending->received).count());
+            if (pending->last) {
+                loop.arm(linger, LINGER_MS);
+            }
+            acks.put_free(pending);
+        }
+    });
+    loop.before_wait([&net]() { net.flush(); });
+    watch_socket();
+
+    loop.run();
+    net.drain();
+    verifier.join();
+
+    if (!ack_latency_us.empty()) {
+        sort(ack_latency_us.begin(), ack_latency_us.end());
+        cout << "ACK latency p50 " << ack_latency_us[ack_latency_us.size() / 2] << " us, p99 "
+             << ack_latency_us[ack_latency_us.size() * 99 / 100] << " us, max " << ack_latency_us.back() << " us" << endl;
+    }
+    return bytes_received;
+}
+
+// CPU time per GB of payload, for comparing I/O paths
+void report_cpu(long long bytes) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+    double sys = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    cout << "CPU " << user << "s user, " << sys << "s sys";
+    if (bytes > 0) {
+        cout << ", " << (user + sys) / (bytes / 1e9) << " s/GB";
+    }
+    cout << endl;
+}
+
+int main(int argc, char *argv[]) {
+    int recv_port = 0;
+    int window = 0;
+    double rate_mbps = 0, rtt_ms = 0;
+    bool use_uring = false, sqpoll = false;
+    bool persistent = false, pull = false;
+    string output, key_file, store_dir, eviction = "lru", trace_file, durability_name = "flush";
+    long store_mb = CHUNK_STORE_MB;
+
+    parse_arguments(argc, argv, recv_port, window, rate_mbps, rtt_ms, use_uring, sqpoll, persistent, pull, output, key_file, store_dir,
+                    store_mb, eviction, trace_file, durability_name);
+
+    Durability durability = durability_name == "none" ? DURABILITY_NONE : durability_name == "direct" ? DURABILITY_DIRECT : DURABILITY_FLUSH;
+    if (recv_port == 0 || store_mb <= 0 || (eviction != "lru" && eviction != "fifo") ||
+        (durability_name != "none" && durability_name != "flush" && durability_name != "direct")) {
+        cerr << "Usage: recvfile -p <recv port> [-w <window frames>] [-b <Mbit/s> -t <rtt ms>] [-u | -U] [-k] [-P] [-o <output> | -] [-K <key file>] [-C <chunk store dir> [-M <MB>] [-E lru | fifo]] [-T <trace file>] [-s none | flush | direct]" << endl;
+        return 1;
+    }
+
+    // Data goes to stdout, so the log goes to stderr
+    if (output == "-") {
+        cout.rdbuf(cerr.rdbuf());
+    }
+
+    // With a key only frames sealed under it are accepted
+    unsigned char key[KEY_SIZE];
+    if (!key_file.empty() && !load_key(key_file.c_str(), key)) {
+        cerr << "Failed to read a " << KEY_SIZE << "-byte hex key from " << key_file << endl;
+        return 1;
+    }
+
+    // An explicit window wins, otherwise cover the configured path's BDP
+    if (window <= 0) {
+        window = RECV_BUFFER_FRAMES;
+        if (rate_mbps > 0 && rtt_ms > 0) {
+            window = max(window, bdp_frames(rate_mbps, rtt_ms));
+        }
+    }
+
+    int sockfd = create_socket(window);
+    PacketLog trace(trace_file);
+    if (!trace_file.empty()) {
+        enable_timestamping(sockfd, false);
+    }
+
+    struct sockaddr_in recv_addr = setup_recv_addr(recv_port);
+
+    if (bind(sockfd, (struct sockaddr *)&recv_addr, sizeof(recv_addr)) < 0) {
+        perror("Bind failed");
+        close(sockfd);
+        return 1;
+    }
+
+    // One ring for the network thread, one for the disk thread
+    IoUring net_ring, disk_ring;
+    if (use_uring && !(net_ring.setup(URING_ENTRIES, sqpoll) && disk_ring.setup(WRITE_BEHIND_BLOCKS, sqpoll))) {
+        perror("io_uring unavailable, using classic I/O");
+        use_uring = false;
+    }
+    cout << "I/O path: " << (use_uring ? (sqpoll ? "io_uring (SQPOLL)" : "io_uring") : "classic") << ", durability " << durability_name << endl;
+    if (pull) {
+        cout << "Pull mode: " << window << " frames of credit shared by up to " << PULL_OVERCOMMIT << " transfers" << endl;
+    }
+
+    // Chunks of earlier files, for senders that deduplicate
+    ChunkStore *store = nullptr;
+    if (!store_dir.empty()) {
+        store = new ChunkStore(store_dir, (uint64_t)store_mb << 20, eviction == "lru");
+        cout << "Chunk store " << store_dir << ": " << store->count() << " chunks, " << store->bytes() << " of " << ((uint64_t)store_mb << 20)
+             << " bytes, " << eviction << " eviction" << endl;
+    }
+
+    // Lives until the rings go, as posted receives point into it
+    RecvPath net(sockfd, use_uring ? &net_ring : nullptr);
+    long long bytes_received = receive_data(net, use_uring ? &disk_ring : nullptr, window, persistent, pull, output,
+                                            key_file.empty() ? nullptr : key, store, trace_file.empty() ? nullptr : &trace, durability);
+    if (!trace_file.empty()) {
+        trace.report();
+    }
+
+    close(sockfd);
+    delete store;
+    report_cpu(bytes_received);
+    cout << "[completed]" << endl;
+    return 0;
+}
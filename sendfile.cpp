@@ -1,554 +1,2174 @@
-// sendfile.cpp
-#include <iostream>
-#include <fstream>
-#include <sys/socket.h>
-#include <arpa/inet.h>
-#include <unistd.h>
-#include <cstring>
-#include <getopt.h>
-#include <map>
-
-using namespace std;
-
-#define MAX_DATA_SIZE 512  // Each frame carries up to 512 bytes
-#define MAX_FRAME_SIZE 522  // Frame size: headers + data + checksum
-#define ACK_SIZE 6
-#define WINDOW_SIZE 5  // Sliding window size
-#define TIMEOUT_MS 500  // Retransmission timeout in milliseconds
-
-enum PacketType {
-    FILENAME = 1,
-    FILEDATA = 2,
-    END_OF_TRANSFER = 3
-};
-
-// Simple checksum function
-unsigned char checksum(const unsigned char *frame, int count) {
-    unsigned long sum = 0;
-    while (count--) {
-        sum += *frame++;
-        if (sum & 0xFF00) {
-            sum &= 0xFF;
-            sum++;
-        }
-    }
-    return (unsigned char)(sum & 0xFF);
-}
-
-// Create data frame
-int create_frame(PacketType pkt_type, int seq_num, const unsigned char *data, int data_size, unsigned char *frame) {
-    frame[0] = static_cast<unsigned char>(pkt_type);
-    uint32_t net_seq_num = htonl(seq_num);
-    uint32_t net_data_size = htonl(data_size);
-    memcpy(frame + 1, &net_seq_num, 4);
-    memcpy(frame + 5, &net_data_size, 4);
-    memcpy(frame + 9, data, data_size);
-    frame[data_size + 9] = checksum(frame, data_size + 9);  // Calculate checksum
-    return data_size + 10;
-}
-
-// Create ACK
-void create_ack(int seq_num, unsigned char *ack, bool error) {
-    ack[0] = error ? 0x0 : 0x1;
-    uint32_t net_seq_num = htonl(seq_num);
-    memcpy(ack + 1, &net_seq_num, 4);
-    ack[5] = checksum(ack, ACK_SIZE - 1);
-}
-
-// Read ACK
-bool read_ack(int *seq_num, bool *error, const unsigned char *ack) {
-    *error = ack[0] == 0x0;
-    uint32_t net_seq_num;
-    memcpy(&net_seq_num, ack + 1, 4);
-    *seq_num = ntohl(net_seq_num);
-    return ack[5] != checksum(ack, ACK_SIZE - 1);
-}
-
-// Create UDP socket
-int create_socket() {
-    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd < 0) {
-        perror("Socket creation failed");
-        exit(1);
-    }
-    return sockfd;
-}
-
-// Parse command line arguments
-void parse_arguments(int argc, char *argv[], string &recv_host, int &recv_port, string &subdir, string &filename) {
-    int opt;
-    while ((opt = getopt(argc, argv, "r:f:")) != -1) {
-        switch (opt) {
-        case 'r': {
-            char *host_port = strtok(optarg, ":");
-            char *port_str = strtok(NULL, ":");
-            if (!host_port || !port_str) {
-                cerr << "Invalid receiver address format" << endl;
-                exit(1);
-            }
-            recv_host = host_port;
-            recv_port = atoi(port_str);
-            break;
-        }
-        case 'f': {
-            char *last_slash = strrchr(optarg, '/');
-            if (last_slash) {
-                subdir = string(optarg, last_slash - optarg);
-                filename = string(last_slash + 1);
-            } else {
-                subdir = ".";
-                filename = optarg;
-            }
-            break;
-        }
-        default:
-            cerr << "Usage: sendfile -r <recv host>:<recv port> -f <subdir>/<filename>" << endl;
-            exit(1);
-        }
-    }
-}
-
-// Set up receiver address
-struct sockaddr_in setup_recv_addr(const string &recv_host, int recv_port) {
-    struct sockaddr_in recv_addr;
-    memset(&recv_addr, 0, sizeof(recv_addr));
-    recv_addr.sin_family = AF_INET;
-    recv_addr.sin_port = htons(recv_port);
-    if (inet_pton(AF_INET, recv_host.c_str(), &recv_addr.sin_addr) <= 0) {
-        perror("Invalid receiver IP address");
-        exit(1);
-    }
-    return recv_addr;
-}
-
-// Send frame with retransmission
-void send_frame_with_retransmission(int sockfd, struct sockaddr_in &recv_addr, const unsigned char *frame, int frame_size, int seq_num) {
-    unsigned char ack[ACK_SIZE];
-    socklen_t addr_len = sizeof(recv_addr);
-    bool ack_received = false;
-
-    while (!ack_received) {
-        // Send the frame
-        if (sendto(sockfd, frame, frame_size, 0, (struct sockaddr *)&recv_addr, sizeof(recv_addr)) < 0) {
-            perror("Failed to send frame");
-            exit(1);
-        }
-
-        // Wait for ACK
-        fd_set fds;
-        struct timeval timeout;
-        timeout.tv_sec = TIMEOUT_MS / 1000;
-        timeout.tv_usec = (TIMEOUT_MS % 1000) * 1000;
-        FD_ZERO(&fds);
-        FD_SET(sockfd, &fds);
-
-        int result = select(sockfd + 1, &fds, NULL, NULL, &timeout);
-        if (result > 0) {
-            // Receive ACK
-            if (recvfrom(sockfd, ack, ACK_SIZE, 0, (struct sockaddr *)&recv_addr, &addr_len) < 0) {
-                perror("Failed to receive ACK");
-                exit(1);
-            }
-
-            int ack_seq_num;
-            bool error;
-            if (!read_ack(&ack_seq_num, &error, ack) && !error && ack_seq_num == seq_num) {
-                ack_received = true;
-            } else {
-                cout << "Received corrupt or incorrect ACK, retransmitting seq_num " << seq_num << endl;
-            }
-        } else {
-            // Timeout, retransmit
-            cout << "Timeout waiting for ACK, retransmitting seq_num " << seq_num << endl;
-        }
-    }
-}
-
-// Send data function with sliding window
-void send_data(int sockfd, struct sockaddr_in &recv_addr, ifstream &file, int &seq_num) {
-    map<int, pair<unsigned char *, int>> frame_map;
-    int base = seq_num;
-    int next_seq_num = seq_num;
-    bool send_done = false;
-
-    while (!send_done || base != next_seq_num) {
-        // Send frames within the window
-        while (next_seq_num < base + WINDOW_SIZE && !send_done) {
-            unsigned char data[MAX_DATA_SIZE];
-            file.read((char *)data, MAX_DATA_SIZE);
-            int data_size = file.gcount();
-
-            unsigned char *frame = new unsigned char[MAX_FRAME_SIZE];
-            int frame_size = create_frame(FILEDATA, next_seq_num, data, data_size, frame);
-            frame_map[next_seq_num] = make_pair(frame, frame_size);
-
-            // Send the frame
-            if (sendto(sockfd, frame, frame_size, 0, (struct sockaddr *)&recv_addr, sizeof(recv_addr)) < 0) {
-                perror("Failed to send frame");
-                exit(1);
-            }
-
-            cout << "[send data] seq_num " << next_seq_num << " sent" << endl;
-            next_seq_num++;
-
-            if (file.eof()) {
-                send_done = true;
-                break;
-            }
-        }
-
-        // Wait for ACKs
-        fd_set fds;
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = TIMEOUT_MS * 1000;  // Timeout in microseconds
-        FD_ZERO(&fds);
-        FD_SET(sockfd, &fds);
-
-        int result = select(sockfd + 1, &fds, NULL, NULL, &timeout);
-        if (result > 0) {
-            // Receive ACK
-            unsigned char ack[ACK_SIZE];
-            socklen_t addr_len = sizeof(recv_addr);
-            if (recvfrom(sockfd, ack, ACK_SIZE, 0, (struct sockaddr *)&recv_addr, &addr_len) < 0) {
-                perror("Failed to receive ACK");
-                exit(1);
-            }
-
-            int ack_seq_num;
-            bool error;
-            if (!read_ack(&ack_seq_num, &error, ack) && !error) {
-                cout << "Received ACK for frame " << ack_seq_num << endl;
-                if (ack_seq_num >= base) {
-                    // Slide the window
-                    for (int i = base; i <= ack_seq_num; i++) {
-                        delete[] frame_map[i].first;
-                        frame_map.erase(i);
-                    }
-                    base = ack_seq_num + 1;
-                }
-            } else {
-                cout << "Received corrupt or incorrect ACK" << endl;
-            }
-        } else {
-            // Timeout occurred, retransmit frames in the window
-            cout << "Timeout, retransmitting frames from " << base << " to " << next_seq_num - 1 << endl;
-            for (int i = base; i < next_seq_num; i++) {
-                auto &frame_pair = frame_map[i];
-                if (sendto(sockfd, frame_pair.first, frame_pair.second, 0, (struct sockaddr *)&recv_addr, sizeof(recv_addr)) < 0) {
-                    perror("Failed to retransmit frame");
-                    exit(1);
-                }
-                cout << "[retransmit] seq_num " << i << endl;
-            }
-        }
-    }
-
-    // Send End-of-Transfer packet
-    unsigned char eot_frame[MAX_FRAME_SIZE];
-    int eot_frame_size = create_frame(END_OF_TRANSFER, next_seq_num, nullptr, 0, eot_frame);
-    send_frame_with_retransmission(sockfd, recv_addr, eot_frame, eot_frame_size, next_seq_num);
-    cout << "End-of-Transfer packet sent." << endl;
-    seq_num = next_seq_num + 1;
-}
-
-// Send filename and directory
-void send_filename(int sockfd, struct sockaddr_in &recv_addr, const string &subdir, const string &filename, int &seq_num) {
-    // Prepare the filename data
-    string filepath = subdir + "/" + filename;
-    unsigned char data[MAX_DATA_SIZE];
-    size_t total_length = filepath.length();
-    if (total_length > MAX_DATA_SIZE) {
-        cerr << "File path too long to send" << endl;
-        exit(1);
-    }
-    memcpy(data, filepath.c_str(), total_length);
-
-    // Create frame
-    unsigned char frame[MAX_FRAME_SIZE];
-    int frame_size = create_frame(FILENAME, seq_num, data, total_length, frame);
-
-    // Send frame with retransmission
-    send_frame_with_retransmission(sockfd, recv_addr, frame, frame_size, seq_num);
-    cout << "Filename sent: " << filepath << endl;
-    seq_num++;
-}
-
-int main(int argc, char *argv[]) {
-    string recv_host, subdir, filename;
-    int recv_port = 0;
-
-    parse_arguments(argc, argv, recv_host, recv_port, subdir, filename);
-
-    if (recv_host.empty() || recv_port == 0 || filename.empty()) {
-        cerr << "Usage: sendfile -r <recv host>:<recv port> -f <subdir>/<filename>" << endl;
-        return 1;
-    }
-
-    int sockfd = create_socket();
-
-    struct sockaddr_in recv_addr = setup_recv_addr(recv_host, recv_port);
-
-    string file_path = subdir + "/" + filename;
-    ifstream file(file_path, ios::in | ios::binary);
-    if (!file.is_open()) {
-        cerr << "Error opening file: " << file_path << endl;
-        close(sockfd);
-        return 1;
-    }
-
-    int seq_num = 0;
-
-    // Send filename and directory
-    send_filename(sockfd, recv_addr, subdir, filename, seq_num);
-
-    // Send file data
-    send_data(sockfd, recv_addr, file, seq_num);
-
-    close(sockfd);
-    cout << "[completed]" << endl;
-    return 0;
-}
-
-
-
-// #include <stdio.h>  // 标准输入输出库，用于文件操作和打印消息
-// #include <stdlib.h> // 标准库，包含了`exit()`函数等
-// #include <string.h> // 字符串操作库，用于处理字符串
-// #include <unistd.h> // 提供UNIX系统调用函数，例如`close()`用于关闭文件描述符
-// #include <arpa/inet.h> // 提供与网络地址操作相关的函数和结构体，例如`inet_addr()`
-// #include <sys/socket.h> // 提供创建套接字以及进行网络通信的函数和结构体
-// #include <sys/time.h>
-
-// #define BUF_SIZE 1024
-// #define WINDOW_SIZE 4
-// #define TIMEOUT 5  // 超时时间 (秒)
-// // #define FILENAME "testfile.bin"
-// #define FILENAME "testfile_10MB.bin"
-
-// // 处理程序中的错误。当发生错误时，perror()函数会打印详细的错误信息，
-// // 然后程序会通过exit(1)安全退出。错误处理非常重要，因为它有助于在出错时提供有用的信息。
-// void error_handling(const char *message) {
-//     perror(message);
-//     exit(1);
-// }
-
-
-// int main(int argc, char *argv[]) {
-//     int sock;
-//     struct sockaddr_in recv_addr;
-//     FILE *fp;
-//     char buffer[BUF_SIZE];
-//     int bytes_read, sent_bytes, ack_num;
-//     int base = 0, next_seq_num = 0;
-//     socklen_t addr_len;
-//     struct timeval tv;
-//     fd_set reads, temp;
-//     long file_size;
-
-//     // 检查命令行参数
-//     // argv[1]：接收端的IP地址。
-//     // argv[2]：接收端的端口号。
-//     // 如果参数不对就退出
-//     if (argc != 3) {
-//         printf("Usage: %s <Receiver IP> <Receiver Port>\n", argv[0]);
-//         exit(1);
-//     }
-
-//     // 创建UDP套接字
-//     // PF_INET：表示IPv4协议。
-//     // SOCK_DGRAM：表示使用UDP协议进行数据报通信。
-//     // 0：协议号，设置为0表示自动选择UDP协议。
-//     // 如果套接字创建失败，程序会调用error_handling()进行错误处理并退出。
-//     sock = socket(PF_INET, SOCK_DGRAM, 0);
-//     if (sock == -1) {
-//         error_handling("socket() error");
-//     }
-
-//     memset(&recv_addr, 0, sizeof(recv_addr));
-//     recv_addr.sin_family = AF_INET; // 使用IPv4地址族
-//     recv_addr.sin_addr.s_addr = inet_addr(argv[1]); // 接收端IP地址
-//     recv_addr.sin_port = htons(atoi(argv[2])); // 接收端端口号 (需要更改)
-
-//     // 打开文件
-//     fp = fopen(FILENAME, "rb");
-//     if (fp == NULL) {
-//         error_handling("fopen() error");
-//     }
-
-//     // 获取文件大小
-//     fseek(fp, 0, SEEK_END);
-//     file_size = ftell(fp);
-//     rewind(fp);
-//     printf("File size: %ld bytes\n", file_size);
-
-//     // 发送文件大小到接收端
-//     file_size = htonl(file_size);
-//     sendto(sock, &file_size, sizeof(file_size), 0, (struct sockaddr*)&recv_addr, sizeof(recv_addr));
-
-//     FD_ZERO(&reads);
-//     FD_SET(sock, &reads);
-//     tv.tv_sec = TIMEOUT;
-//     tv.tv_usec = 0;
-
-//     while (1) {
-//         // 发送窗口内的数据包
-//         while (next_seq_num < base + WINDOW_SIZE && (bytes_read = fread(buffer + sizeof(int), 1, BUF_SIZE - sizeof(int), fp)) > 0) {
-//             // 将序列号封装到数据包前
-//             int network_seq_num = htonl(next_seq_num);
-//             memcpy(buffer, &network_seq_num, sizeof(network_seq_num));
-
-//             printf("Sending packet %d\n", next_seq_num);
-//             sent_bytes = sendto(sock, buffer, bytes_read + sizeof(int), 0, (struct sockaddr*)&recv_addr, sizeof(recv_addr));
-//             if (sent_bytes == -1) {
-//                 error_handling("sendto() error");
-//             }
-//             next_seq_num++;
-//         }
-
-//         // 等待ACK，使用select设置超时
-//         temp = reads;
-//         if (select(sock + 1, &temp, 0, 0, &tv) == -1) {
-//             error_handling("select() error");
-//         }
-
-//         if (FD_ISSET(sock, &temp)) {
-//             addr_len = sizeof(recv_addr);
-//             if (recvfrom(sock, &ack_num, sizeof(ack_num), 0, (struct sockaddr*)&recv_addr, &addr_len) > 0) {
-//                 ack_num = ntohl(ack_num);  // 将网络字节序转换回主机字节序
-//                 printf("Received ACK for packet %d\n", ack_num);
-//                 base = ack_num + 1;  // 滑动窗口
-//             }
-//         } else {
-//             // 超时重传窗口中的数据包
-//             printf("Timeout, resending window from packet %d\n", base);
-//             fseek(fp, base * (BUF_SIZE - sizeof(int)), SEEK_SET);  // 重置文件指针
-//             next_seq_num = base;
-//         }
-
-//         // 如果所有数据包已确认，退出
-//         if (feof(fp) && base == next_seq_num) {
-//             break;
-//         }
-//     }
-
-//     // 发送结束信号
-//     int end_signal = -1;  // 使用特殊序列号标识结束信号
-//     end_signal = htonl(end_signal);
-//     sendto(sock, &end_signal, sizeof(end_signal), 0, (struct sockaddr*)&recv_addr, sizeof(recv_addr));
-//     printf("Sent end signal\n");
-
-//     fclose(fp);
-//     close(sock);
-//     printf("[completed] File transfer completed.\n");
-//     return 0;
-// }
-
-
-
-// #include <stdio.h>         // 标准输入输出库，用于文件操作和打印消息
-// #include <stdlib.h>        
-// #include <string.h>        // 字符串操作库，用于处理字符串
-// #include <unistd.h>        // 提供UNIX系统调用函数，例如`close()`用于关闭文件描述符
-// #include <arpa/inet.h>     // 提供与网络地址操作相关的函数和结构体，例如`inet_addr()`
-// #include <sys/socket.h>    // 提供创建套接字以及进行网络通信的函数和结构体
-
-// #define BUF_SIZE 1024  // 定义每个数据包的大小
-// // #define FILENAME "testfile.txt"  // 假设我们传输的文件名为testfile.txt
-// #define FILENAME "testfile.bin"
-// #define END_SIGNAL "END"  // 结束信号
-
-// // 处理程序中的错误。当发生错误时，perror()函数会打印详细的错误信息，
-// // 然后程序会通过exit(1)安全退出。错误处理非常重要，因为它有助于在出错时提供有用的信息。
-// void error_handling(const char *message) {
-//     perror(message);       // 打印系统错误信息
-//     exit(1);               // 退出程序，错误码为1
-// }
-
-// int main(int argc, char *argv[]) {
-//     // sock：表示套接字的文件描述符，用于网络通信。
-//     // recv_addr：存储接收端的IP地址和端口信息。
-//     // fp：文件指针，用于读取要发送的文件。
-//     // buffer[]：数据缓冲区，用于存储每次从文件中读取的内容。
-//     // bytes_read 和 sent_bytes：分别表示读取的字节数和发送的字节数。
-//     int sock;
-//     struct sockaddr_in recv_addr;
-//     FILE *fp;
-//     char buffer[BUF_SIZE];
-//     int bytes_read, sent_bytes;
-    
-//     // 检查命令行参数
-//     // argv[1]：接收端的IP地址。
-//     // argv[2]：接收端的端口号。
-//     // 如果参数不对就退出
-//     if (argc != 3) {
-//         printf("Usage: %s <Receiver IP> <Receiver Port>\n", argv[0]);
-//         exit(1);
-//     }
-    
-//     // 创建UDP套接字
-//     // PF_INET：表示IPv4协议。
-//     // SOCK_DGRAM：表示使用UDP协议进行数据报通信。
-//     // 0：协议号，设置为0表示自动选择UDP协议。
-//     // 如果套接字创建失败，程序会调用error_handling()进行错误处理并退出。
-//     sock = socket(PF_INET, SOCK_DGRAM, 0);
-//     if (sock == -1) {
-//         error_handling("socket() error");
-//     }
-
-//     // 配置接收端的地址信息
-//     memset(&recv_addr, 0, sizeof(recv_addr));
-//     recv_addr.sin_family = AF_INET; // 使用IPv4地址族
-//     recv_addr.sin_addr.s_addr = inet_addr(argv[1]);  // 接收端IP地址
-//     recv_addr.sin_port = htons(atoi(argv[2]));  // 接收端端口号
-
-//     // 打开要发送的文件，rb模式表示以二进制只读方式打开文件。如果文件不存在或无法打开，程序会报错并退出。
-//     fp = fopen(FILENAME, "rb");
-//     if (fp == NULL) {
-//         error_handling("fopen() error");
-//     } else {
-//         fseek(fp, 0, SEEK_END);   // 移动到文件末尾
-//         long file_size = ftell(fp);  // 获取文件大小
-//         rewind(fp);  // 重置文件指针
-//         printf("File opened successfully, size: %ld bytes\n", file_size);
-//     }
-
-//     // 读取文件并通过UDP发送
-//     // 从文件中读取数据并通过UDP发送：
-//     // fread(buffer, 1, BUF_SIZE, fp)：每次从文件读取BUF_SIZE字节的数据（即1024字节），并存储到缓冲区buffer中。
-//     // sendto(sock, buffer, bytes_read, 0, (struct sockaddr*)&recv_addr, sizeof(recv_addr))：使用sendto()函数通过UDP发送读取到的字节数据。
-//     // sock：UDP套接字。
-//     // buffer：要发送的数据。
-//     // bytes_read：读取到的数据长度。
-//     // (struct sockaddr*)&recv_addr：接收端的地址信息。
-//     while ((bytes_read = fread(buffer, 1, BUF_SIZE, fp)) > 0) {
-//         printf("Bytes read from file: %zu\n", bytes_read);  // 调试输出
-//         // 可选：打印缓冲区前10个字节的内容（十六进制）
-//         printf("Buffer content: ");
-//         for(int i = 0; i < bytes_read && i < 10; i++) {
-//             printf("%02x ", (unsigned char)buffer[i]);
-//         }
-//         printf("\n");
-
-//         sent_bytes = sendto(sock, buffer, bytes_read, 0, (struct sockaddr*)&recv_addr, sizeof(recv_addr));
-//         if (sent_bytes != bytes_read) {
-//             error_handling("sendto() error");
-//         }
-//         printf("[send data] %zu bytes sent\n", sent_bytes);
-//     }
-//     // 在文件发送完毕后，发送一个结束信号
-//     sent_bytes = sendto(sock, END_SIGNAL, strlen(END_SIGNAL), 0, (struct sockaddr*)&recv_addr, sizeof(recv_addr));
-//     if (sent_bytes != strlen(END_SIGNAL)) {
-//         error_handling("sendto() error");
-//     }
-//     printf("[send data] End signal sent\n");
-
-
-//     // 文件发送完毕后，关闭文件和套接字
-//     fclose(fp);
-//     close(sock);
-//     printf("[completed] File transfer completed.\n");
-    
-//     return 0;
-// }
-
+// sendfile.cpp
+#include <iostream>
+#include <fstream>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cstring>
+#include <getopt.h>
+#include <map>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "event_loop.h"
+#include "spsc_queue.h"
+#include "uring.h"
+#include "frame_codec.h"
+#include "frame_cipher.h"
+#include "chunk_store.h"
+#include "packet_trace.h"
+
+using namespace std;
+
+#define WINDOW_SIZE 5  // Sliding window size
+#define TIMEOUT_MS 500  // Retransmission timeout in milliseconds
+#define MIN_RTO_MS 50  // Floor for the estimated per-frame timeout
+#define MAX_RTO_MS 4000  // Ceiling for the backed-off per-frame timeout
+#define SKB_OVERHEAD 768  // Kernel bookkeeping charged per queued datagram
+#define READ_BLOCK_SIZE (64 * 1024)  // Size of each disk read
+#define READ_AHEAD_BLOCKS 4  // Blocks the disk thread may read ahead
+#define FRAMES_PER_BLOCK (READ_BLOCK_SIZE / MAX_DATA_SIZE)
+#define URING_ENTRIES 256  // Submission queue depth of the network ring
+#define ACK_SLOTS 16  // ACK receives kept posted on the network ring
+#define LOSS_GAIN 0.1  // Weight of each frame in a path's loss estimate
+#define MIN_PATH_SHARE 0.01  // Below this share of the best path's weight a path is probed
+#define PATH_PROBE_MS 1000  // Interval between probes of a starved path
+#define PULL_UNSCHEDULED 4  // Frames sent in pull mode before the receiver grants any
+#define MAX_ACTIVE_TRANSFERS 8  // Transfers a sender runs at once, later jobs queue
+#define CLASS_SPAN_FRAMES (1 << 21)  // Rank distance between priority classes, 1 GB of frames
+#define AGING_FRAMES_PER_MS 64  // Rank a transfer gains for every ms it waits to send
+
+// Create data frame, sealed instead of checksummed when the session has a
+// key; the payload is encrypted on its way into the frame, not copied first
+int create_frame(PacketType pkt_type, int seq_num, const unsigned char *data, int data_size, unsigned char *frame,
+                 FrameCipher *cipher) {
+    if (cipher) {
+        FrameWriter<SealedFrame> out(frame);
+        out.set<SealedFrame::Type>(pkt_type);
+        out.set<SealedFrame::Seq>(seq_num);
+        int frame_size = out.finish(data_size);
+        if (frame_size >= 0) {
+            cipher->seal<SealedFrame>(frame, data, data_size, pkt_type, seq_num);
+        }
+        return frame_size;
+    }
+    FrameWriter<DataFrame> out(frame);
+    out.set<DataFrame::Type>(pkt_type);
+    out.set<DataFrame::Seq>(seq_num);
+    memcpy(out.payload(), data, data_size);
+    return out.finish(data_size);
+}
+
+// Read ACK: acked seq_num, the receiver's next expected seq_num (cumulative),
+// the number of frames it can still accept beyond that point and how many
+// datagrams its kernel has dropped on the socket so far. A sealed ACK shares
+// the plain layout's fields and is only read once its tag checks out.
+// An answer to a chunk query also points needs at its bitmap, otherwise
+// needs_size is -1.
+bool read_ack(int *seq_num, int *next_expected, int *window, uint32_t *drops, bool *error, const unsigned char **needs,
+              int *needs_size, unsigned char *ack, int ack_size, FrameCipher *cipher) {
+    *needs_size = -1;
+    if (ack_size > 0 && AckFrame::Flag::load(ack) == ACK_NEEDS) {
+        if (cipher) {
+            FrameReader<SealedNeedsAck> in(ack, ack_size);
+            if (!in.ok() || !cipher->open<SealedNeedsAck>(ack, in.payload_size(), ACK_NONCE_KIND, in.get<SealedNeedsAck::Counter>())) {
+                return true;
+            }
+            *needs = in.payload();
+            *needs_size = in.payload_size();
+        } else {
+            FrameReader<NeedsAck> in(ack, ack_size);
+            if (!in.ok()) {
+                return true;
+            }
+            *needs = in.payload();
+            *needs_size = in.payload_size();
+        }
+    } else if (cipher) {
+        FrameReader<SealedAck> in(ack, ack_size);
+        if (!in.ok() || !cipher->open<SealedAck>(ack, 0, ACK_NONCE_KIND, in.get<SealedAck::Counter>())) {
+            return true;
+        }
+    } else if (!FrameReader<AckFrame>(ack, ack_size).ok()) {
+        return true;
+    }
+    *error = AckFrame::Flag::load(ack) == ACK_ERROR;
+    *seq_num = AckFrame::Seq::load(ack);
+    *next_expected = AckFrame::NextExpected::load(ack);
+    *window = AckFrame::Window::load(ack);
+    *drops = AckFrame::Drops::load(ack);
+    return false;
+}
+
+// Session header: the FILENAME frame with the file's path, size and our window
+int create_session_frame(int seq_num, const string &filepath, uint64_t file_size, int window, unsigned char *frame,
+                         FrameCipher *cipher) {
+    if (filepath.length() > SessionHeader::max_path) {
+        cerr << "File path too long to send" << endl;
+        exit(1);
+    }
+    unsigned char data[MAX_DATA_SIZE];
+    SessionHeader::FileSize::store(data, file_size);
+    SessionHeader::Window::store(data, window);
+    memcpy(data + SessionHeader::size, filepath.c_str(), filepath.length());
+    return create_frame(FILENAME, seq_num, data, SessionHeader::size + filepath.length(), frame, cipher);
+}
+
+// Frames needed to cover a bandwidth-delay product
+int bdp_frames(double rate_mbps, double rtt_ms) {
+    double bdp_bytes = rate_mbps * 1e6 / 8 * rtt_ms / 1000;
+    return (int)(bdp_bytes / MAX_DATA_SIZE) + 1;
+}
+
+// Size a socket buffer, bypassing rmem_max/wmem_max when we are privileged
+int set_socket_buffer(int sockfd, int force_opt, int opt, int bytes) {
+    if (setsockopt(sockfd, SOL_SOCKET, force_opt, &bytes, sizeof(bytes)) < 0 &&
+        setsockopt(sockfd, SOL_SOCKET, opt, &bytes, sizeof(bytes)) < 0) {
+        perror("Failed to size socket buffer");
+    }
+    int actual = 0;
+    socklen_t len = sizeof(actual);
+    getsockopt(sockfd, SOL_SOCKET, opt, &actual, &len);
+    return actual;
+}
+
+// Create UDP socket with a send buffer large enough for a full window
+int create_socket(int window) {
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0) {
+        perror("Socket creation failed");
+        exit(1);
+    }
+    int wanted = window * (MAX_FRAME_SIZE + SKB_OVERHEAD);
+    int actual = set_socket_buffer(sockfd, SO_SNDBUFFORCE, SO_SNDBUF, wanted);
+    cout << "Send buffer " << actual << " bytes (wanted " << wanted << " for " << window << " frames)" << endl;
+    return sockfd;
+}
+
+// Parse command line arguments
+// -r may repeat, one receiver address per path; they are kept as a comma
+// separated list, the same form daemon jobs use
+void parse_arguments(int argc, char *argv[], string &receivers, string &subdir, string &filename,
+                     int &window, double &rate_mbps, double &rtt_ms, bool &use_uring, bool &sqpoll, int &workers, bool &daemon,
+                     bool &pull, string &policy, string &key_file, bool &dedup, string &trace_file) {
+    int opt;
+    while ((opt = getopt(argc, argv, "r:f:w:b:t:uUj:dPS:K:DT:")) != -1) {
+        switch (opt) {
+        case 'r': {
+            const char *colon = strrchr(optarg, ':');
+            if (!colon || colon == optarg || atoi(colon + 1) == 0) {
+                cerr << "Invalid receiver address format" << endl;
+                exit(1);
+            }
+            receivers += (receivers.empty() ? "" : ",") + string(optarg);
+            break;
+        }
+        case 'f': {
+            char *last_slash = strrchr(optarg, '/');
+            if (last_slash) {
+                subdir = string(optarg, last_slash - optarg);
+                filename = string(last_slash + 1);
+            } else {
+                subdir = ".";
+                filename = optarg;
+            }
+            break;
+        }
+        case 'w':
+            window = atoi(optarg);
+            break;
+        case 'b':
+            rate_mbps = atof(optarg);
+            break;
+        case 't':
+            rtt_ms = atof(optarg);
+            break;
+        case 'U':
+            sqpoll = true;
+            // Fall through
+        case 'u':
+            use_uring = true;
+            break;
+        case 'j':
+            workers = atoi(optarg);
+            break;
+        case 'd':
+            daemon = true;
+            break;
+        case 'P':
+            pull = true;
+            break;
+        case 'S':
+            policy = optarg;
+            break;
+        case 'K':
+            key_file = optarg;
+            break;
+        case 'D':
+            dedup = true;
+            break;
+        case 'T':
+            trace_file = optarg;
+            break;
+        default:
+            cerr << "Usage: sendfile -r <recv host>:<recv port> [-r ...] -f <subdir>/<filename> | - [-w <window frames>] [-b <Mbit/s> -t <rtt ms>] [-u | -U] [-j <prep workers>] [-d [-S srpt | fifo]] [-P] [-K <key file>] [-D] [-T <trace file>]" << endl;
+            exit(1);
+        }
+    }
+}
+
+// Set up receiver address
+struct sockaddr_in setup_recv_addr(const string &recv_host, int recv_port) {
+    struct sockaddr_in recv_addr;
+    memset(&recv_addr, 0, sizeof(recv_addr));
+    recv_addr.sin_family = AF_INET;
+    recv_addr.sin_port = htons(recv_port);
+    if (inet_pton(AF_INET, recv_host.c_str(), &recv_addr.sin_addr) <= 0) {
+        perror("Invalid receiver IP address");
+        exit(1);
+    }
+    return recv_addr;
+}
+
+// Round-trip time estimator (Jacobson/Karels), drives per-frame deadlines
+struct RttEstimator {
+    double srtt_ms = 0;
+    double rttvar_ms = 0;
+    bool has_sample = false;
+    int rto_ms = TIMEOUT_MS;
+
+    void sample(double rtt_ms) {
+        if (!has_sample) {
+            srtt_ms = rtt_ms;
+            rttvar_ms = rtt_ms / 2;
+            has_sample = true;
+        } else {
+            rttvar_ms = 0.75 * rttvar_ms + 0.25 * fabs(srtt_ms - rtt_ms);
+            srtt_ms = 0.875 * srtt_ms + 0.125 * rtt_ms;
+        }
+        rto_ms = min(max((int)(srtt_ms + 4 * rttvar_ms) + 1, MIN_RTO_MS), MAX_RTO_MS);
+    }
+
+    void backoff() {
+        rto_ms = min(rto_ms * 2, MAX_RTO_MS);
+    }
+};
+
+// One receiver address of a session and what it has delivered so far
+struct PathStats {
+    string name;
+    RttEstimator rtt;
+    double loss = 0;  // Moving share of frames that timed out
+    long long sent = 0;
+    long long lost = 0;
+    double credit = 0;
+    int probe_seq = -1;  // Frame duplicated onto the path to see if it recovered
+    int probe_acks = 0;
+    chrono::steady_clock::time_point last_probe;
+
+    // Frames per ms the path delivers: each costs an RTT, plus an RTO for
+    // the share that is lost
+    double weight() const {
+        double rtt_ms = rtt.has_sample ? max(rtt.srtt_ms, 0.01) : 1.0;
+        return (1 - loss) / (rtt_ms + loss * rtt.rto_ms);
+    }
+
+    void delivered() { loss *= 1 - LOSS_GAIN; }
+
+    void timed_out() {
+        loss = loss * (1 - LOSS_GAIN) + LOSS_GAIN;
+        lost++;
+    }
+};
+
+// Stripes frames over a session's paths by smooth weighted round robin; a
+// starved path is only probed with copies until it earns its share back
+class PathScheduler {
+public:
+    void add(const string &name) {
+        paths_.push_back(PathStats());
+        paths_.back().name = name;
+    }
+
+    int count() const { return paths_.size(); }
+    PathStats &operator[](int path) { return paths_[path]; }
+
+    // Path for the next new frame
+    int pick() {
+        if (paths_.size() == 1) {
+            return 0;
+        }
+        double total = 0;
+        int chosen = 0;
+        for (size_t i = 0; i < paths_.size(); i++) {
+            paths_[i].credit += paths_[i].weight();
+            total += paths_[i].weight();
+            if (paths_[i].credit > paths_[chosen].credit) {
+                chosen = i;
+            }
+        }
+        paths_[chosen].credit -= total;
+        return chosen;
+    }
+
+    // Path for retransmissions and control frames: the heaviest one, other
+    // than the path a frame was just lost on if there is a choice
+    int best(int avoid = -1) const {
+        int chosen = -1;
+        for (size_t i = 0; i < paths_.size(); i++) {
+            if ((int)i != avoid && (chosen < 0 || paths_[i].weight() > paths_[chosen].weight())) {
+                chosen = i;
+            }
+        }
+        return chosen < 0 ? 0 : chosen;
+    }
+
+    // A starved path due for a probe with a copy of frame seq, or -1
+    int probe(int seq) {
+        double max_weight = paths_[best()].weight();
+        auto now = chrono::steady_clock::now();
+        for (PathStats &path : paths_) {
+            if (path.weight() < MIN_PATH_SHARE * max_weight && now - path.last_probe > chrono::milliseconds(PATH_PROBE_MS)) {
+                path.probe_seq = seq;
+                path.probe_acks = 0;
+                path.last_probe = now;
+                return &path - &paths_[0];
+            }
+        }
+        return -1;
+    }
+
+    // Every copy of a frame is acked, so a second ACK for a probed frame
+    // means the probe got through
+    void acked(int seq) {
+        for (PathStats &path : paths_) {
+            if (path.probe_seq == seq && ++path.probe_acks == 2) {
+                path.loss /= 2;
+                path.probe_seq = -1;
+            }
+        }
+    }
+
+private:
+    vector<PathStats> paths_;
+};
+
+// Frame kept until the receiver's cumulative ACK passes it
+struct Frame {
+    unsigned char *data = nullptr;
+    int size = 0;
+    bool acked = false;  // Selectively acked, still below a gap
+    bool retransmitted = false;  // Karn: no RTT samples from these
+    int path = 0;  // Path of the latest transmission
+    chrono::steady_clock::time_point send_time;
+    Timer retransmit_timer;
+};
+
+// Block of file data read ahead by the disk thread, and the frames a
+// prep worker built from it. A block of zeros, read or skipped as a hole,
+// goes out as a single ZERO_RANGE frame instead.
+struct FileBlock {
+    unsigned char *data = nullptr;
+    int size = 0;
+    uint64_t zeros = 0;  // Bytes from offset on that are zero, data unused
+    bool eof = false;
+    uint64_t offset = 0;
+    unsigned char *frames = nullptr;  // Encoded frames, MAX_FRAME_SIZE apart
+    int frame_sizes[FRAMES_PER_BLOCK];
+    int frame_count = 0;
+    int first_seq = 0;
+};
+
+// True if every byte is zero. glibc's memcmp runs on SIMD, and a block
+// whose first 16 bytes are zero is all zeros exactly when it equals itself
+// shifted by 16 bytes.
+bool all_zero(const unsigned char *data, size_t size) {
+    static const unsigned char zeros[16] = {};
+    if (size <= sizeof(zeros)) {
+        return memcmp(data, zeros, size) == 0;
+    }
+    return memcmp(data, zeros, sizeof(zeros)) == 0 && memcmp(data, data + sizeof(zeros), size - sizeof(zeros)) == 0;
+}
+
+// Workers that turn file blocks into frames; block k goes through worker
+// k % N, so frames come back in sequence order
+class FramePrep {
+public:
+    FramePrep(int workers, int first_seq, const FrameCipher *cipher)
+        : next_seq_(first_seq), pool_size_(READ_AHEAD_BLOCKS + workers), free_(pool_size_),
+          ready_signal_(true), stopping_(false), submitted_(0), collected_(0) {
+        blocks_ = new FileBlock[pool_size_];
+        for (int i = 0; i < pool_size_; i++) {
+            blocks_[i].data = new unsigned char[READ_BLOCK_SIZE];
+            blocks_[i].frames = new unsigned char[FRAMES_PER_BLOCK * MAX_FRAME_SIZE];
+            free_.push(&blocks_[i]);
+        }
+        for (int i = 0; i < workers; i++) {
+            workers_.push_back(new Worker(pool_size_, cipher));
+        }
+        for (int i = 0; i < workers; i++) {
+            workers_[i]->runner = thread(&FramePrep::work, this, workers_[i]);
+        }
+    }
+
+    ~FramePrep() {
+        stopping_ = true;
+        for (Worker *worker : workers_) {
+            worker->in_signal.notify();
+            worker->runner.join();
+            delete worker;
+        }
+        for (int i = 0; i < pool_size_; i++) {
+            delete[] blocks_[i].data;
+            delete[] blocks_[i].frames;
+        }
+        delete[] blocks_;
+    }
+
+    FileBlock *blocks() { return blocks_; }
+    int block_count() const { return pool_size_; }
+
+    // Disk side: empty blocks to fill, and filled blocks in file order
+    FileBlock *take_free() {
+        FileBlock *block;
+        while (!free_.pop(block)) {
+            free_signal_.wait();
+        }
+        return block;
+    }
+
+    bool try_take_free(FileBlock *&block) { return free_.pop(block); }
+    void wait_free() { free_signal_.wait(); }
+
+    void submit(FileBlock *block) {
+        if (block->size > 0 && all_zero(block->data, block->size)) {
+            block->zeros = block->size;
+        }
+        block->first_seq = next_seq_;
+        next_seq_ += block->zeros ? 1 : (block->size + MAX_DATA_SIZE - 1) / MAX_DATA_SIZE;
+        Worker *worker = workers_[submitted_++ % workers_.size()];
+        worker->in.push(block);
+        worker->in_signal.notify();
+    }
+
+    // Network side: readable when prepared blocks may be waiting
+    int ready_fd() const { return ready_signal_.fd(); }
+    void clear_ready() { ready_signal_.wait(); }
+
+    // Next prepared block in sequence order, or nullptr if it is not done yet
+    FileBlock *next() {
+        FileBlock *block;
+        if (!workers_[collected_ % workers_.size()]->out.pop(block)) {
+            return nullptr;
+        }
+        collected_++;
+        return block;
+    }
+
+    void release(FileBlock *block) {
+        block->zeros = 0;
+        free_.push(block);
+        free_signal_.notify();
+    }
+
+private:
+    struct Worker {
+        SpscQueue<FileBlock *> in;
+        SpscQueue<FileBlock *> out;
+        QueueSignal in_signal;
+        thread runner;
+        FrameCipher *cipher;  // This worker's own copy
+        Worker(int capacity, const FrameCipher *session_cipher)
+            : in(capacity), out(capacity), cipher(session_cipher ? new FrameCipher(*session_cipher) : nullptr) {}
+        ~Worker() { delete cipher; }
+    };
+
+    void work(Worker *worker) {
+        while (true) {
+            FileBlock *block;
+            if (!worker->in.pop(block)) {
+                if (stopping_) {
+                    return;
+                }
+                worker->in_signal.wait();
+                continue;
+            }
+            prepare(worker, block);
+            worker->out.push(block);
+            ready_signal_.notify();
+        }
+    }
+
+    // Header encode and checksum or seal for every frame of the block
+    void prepare(Worker *worker, FileBlock *block) {
+        block->frame_count = 0;
+        if (block->zeros) {
+            unsigned char range[ZeroRange::size];
+            ZeroRange::Length::store(range, block->zeros);
+            block->frame_sizes[block->frame_count++] =
+                create_frame(ZERO_RANGE, block->first_seq, range, ZeroRange::size, block->frames, worker->cipher);
+            return;
+        }
+        for (int pos = 0; pos < block->size; pos += MAX_DATA_SIZE) {
+            int index = block->frame_count++;
+            block->frame_sizes[index] = create_frame(FILEDATA, block->first_seq + index, block->data + pos,
+                                                     min(MAX_DATA_SIZE, block->size - pos), block->frames + index * MAX_FRAME_SIZE,
+                                                     worker->cipher);
+        }
+    }
+
+    int next_seq_;  // Disk thread only
+    int pool_size_;
+    FileBlock *blocks_;
+    SpscQueue<FileBlock *> free_;
+    QueueSignal free_signal_;
+    QueueSignal ready_signal_;
+    vector<Worker *> workers_;
+    atomic<bool> stopping_;
+    size_t submitted_;  // Disk thread only
+    size_t collected_;  // Network thread only
+};
+
+// Disk stage: keep filling free blocks from the file until EOF, so a slow
+// read never stalls ACK processing on the network thread. In a file that
+// can seek, SEEK_DATA and SEEK_HOLE find its holes, which are passed on
+// as zero blocks without being read, and reads stop short of the next
+// hole. A pipe is read straight through.
+void read_ahead(int fd, FramePrep &prep) {
+    struct stat st;
+    bool sparse = lseek(fd, 0, SEEK_CUR) >= 0 && fstat(fd, &st) == 0;
+    uint64_t offset = 0, hole = sparse ? 0 : UINT64_MAX;  // Where the data in front of us ends
+    bool eof = false;
+    while (!eof) {
+        FileBlock *block = prep.take_free();
+        block->size = 0;
+        block->offset = offset;
+        off_t data = sparse && offset >= hole ? lseek(fd, offset, SEEK_DATA) : 0;
+        if (data < 0 && errno != ENXIO) {
+            // Holes cannot be told apart here, read the rest through
+            sparse = false;
+            hole = UINT64_MAX;
+            lseek(fd, offset, SEEK_SET);
+        }
+        if (sparse && offset >= hole) {
+            if (data < 0 || (uint64_t)data > offset) {
+                // A hole up to the next data, or with ENXIO to the end of the file
+                uint64_t end = data < 0 ? max<uint64_t>(offset, st.st_size) : data;
+                block->zeros = end - offset;
+                offset = end;
+                block->eof = eof = data < 0;
+                prep.submit(block);
+                continue;
+            }
+            off_t next_hole = lseek(fd, offset, SEEK_HOLE);
+            hole = next_hole < 0 ? UINT64_MAX : next_hole;
+            lseek(fd, offset, SEEK_SET);
+        }
+        int wanted = min<uint64_t>(READ_BLOCK_SIZE, hole - offset);
+        ssize_t n = 0;
+        while (block->size < wanted && (n = read(fd, block->data + block->size, wanted - block->size)) > 0) {
+            block->size += n;
+        }
+        if (n < 0) {
+            perror("Failed to read file");
+            exit(1);
+        }
+        offset += block->size;
+        block->eof = eof = block->size < wanted;
+        prep.submit(block);
+    }
+}
+
+// Disk stage of a deduplicated file: only the (offset, length) ranges the
+// receiver lacks, packed back to back as if they were the whole file
+void read_ahead_ranges(int fd, vector<pair<uint64_t, uint64_t>> ranges, FramePrep &prep) {
+    uint64_t offset = 0, range_done = 0;
+    size_t range = 0;
+    bool eof = false;
+    while (!eof) {
+        FileBlock *block = prep.take_free();
+        block->size = 0;
+        while (block->size < READ_BLOCK_SIZE && range < ranges.size()) {
+            size_t wanted = min<uint64_t>(READ_BLOCK_SIZE - block->size, ranges[range].second - range_done);
+            ssize_t n = pread(fd, block->data + block->size, wanted, ranges[range].first + range_done);
+            if (n < 0) {
+                perror("Failed to read file");
+                exit(1);
+            }
+            if (n == 0) {
+                cerr << "File shrank while being sent" << endl;
+                exit(1);
+            }
+            block->size += n;
+            range_done += n;
+            if (range_done == ranges[range].second) {
+                range++;
+                range_done = 0;
+            }
+        }
+        block->offset = offset;
+        offset += block->size;
+        block->eof = eof = block->size < READ_BLOCK_SIZE;
+        prep.submit(block);
+    }
+}
+
+// Disk stage on io_uring: every free block gets a READ_FIXED into its
+// registered buffer, so the whole pool is in flight at once. Completions
+// can arrive in any order and are handed on in file order.
+void read_ahead_uring(IoUring &ring, int fd, FramePrep &prep) {
+    FileBlock *blocks = prep.blocks();
+    vector<struct iovec> iovs(prep.block_count());
+    for (int i = 0; i < prep.block_count(); i++) {
+        iovs[i].iov_base = blocks[i].data;
+        iovs[i].iov_len = READ_BLOCK_SIZE;
+    }
+    if (!ring.register_buffers(iovs.data(), iovs.size()) || !ring.register_files(&fd, 1)) {
+        perror("Failed to register read-ahead buffers");
+        exit(1);
+    }
+
+    map<uint64_t, FileBlock *> completed;
+    uint64_t next_offset = 0, deliver_offset = 0;
+    int in_flight = 0;
+    bool eof = false;
+    while (!eof || in_flight > 0) {
+        FileBlock *block;
+        while (!eof && prep.try_take_free(block)) {
+            int index = block - blocks;
+            block->offset = next_offset;
+            IoUring::prep_read_fixed(ring.get_sqe(), 0, block->data, READ_BLOCK_SIZE, next_offset, index, index);
+            next_offset += READ_BLOCK_SIZE;
+            in_flight++;
+        }
+        if (in_flight == 0) {
+            prep.wait_free();
+            continue;
+        }
+
+        ring.submit(1);
+        struct io_uring_cqe *cqe;
+        while ((cqe = ring.peek_cqe())) {
+            if (cqe->res < 0) {
+                errno = -cqe->res;
+                perror("Failed to read file");
+                exit(1);
+            }
+            FileBlock *done = &blocks[cqe->user_data];
+            done->size = cqe->res;
+            completed[done->offset] = done;
+            in_flight--;
+            ring.cqe_seen();
+        }
+        while (!eof && completed.count(deliver_offset)) {
+            FileBlock *next = completed[deliver_offset];
+            completed.erase(deliver_offset);
+            next->eof = eof = next->size < READ_BLOCK_SIZE;
+            prep.submit(next);
+            deliver_offset += READ_BLOCK_SIZE;
+        }
+    }
+    ring.unregister_buffers();
+    ring.unregister_files();
+}
+
+// Per-frame timing for -T, one CSV row per transmission keyed by port and
+// seq_num; transmit timestamps come back on each socket's error queue
+class PacketTrace {
+public:
+    explicit PacketTrace(const string &path) : path_(path) {}
+
+    // A datagram handed to a socket, in the order the kernel numbers them
+    void sent(int sockfd, const unsigned char *frame, int path) {
+        Transmission sent;
+        sent.sockfd = sockfd;
+        sent.type = DataFrame::Type::load(frame);
+        sent.seq = DataFrame::Seq::load(frame);
+        sent.path = path;
+        sent.send_ns = realtime_ns();
+        if (sent.type != WINDOW_PROBE) {
+            auto latest = latest_.find(make_pair(sockfd, sent.seq));
+            if (latest != latest_.end()) {
+                sent.attempt = log_[latest->second].attempt + 1;
+            }
+            latest_[make_pair(sockfd, sent.seq)] = log_.size();
+        }
+        by_key_[sockfd].push_back(log_.size());
+        log_.push_back(sent);
+    }
+
+    // An ACK read off a socket; it times the latest transmission it answers
+    void acked(int sockfd, const unsigned char *ack, const PacketTimes &times) {
+        auto latest = latest_.find(make_pair(sockfd, (int)AckFrame::Seq::load(ack)));
+        if (latest == latest_.end() || log_[latest->second].ack_read_ns) {
+            return;
+        }
+        Transmission &acked = log_[latest->second];
+        acked.ack_kernel_ns = times.software;
+        acked.ack_read_ns = realtime_ns();
+    }
+
+    // Take the transmit timestamps waiting on a socket's error queue
+    void collect(int sockfd) {
+        vector<size_t> &by_key = by_key_[sockfd];
+        while (true) {
+            char control[TIMESTAMP_CONTROL_SIZE + CMSG_SPACE(sizeof(struct sock_extended_err))];
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (recvmsg(sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+                return;
+            }
+            PacketTimes times = packet_times(msg);
+            for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                if (cmsg->cmsg_level != SOL_IP || cmsg->cmsg_type != IP_RECVERR) {
+                    continue;
+                }
+                struct sock_extended_err err;
+                memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+                if (err.ee_origin != SO_EE_ORIGIN_TIMESTAMPING || err.ee_data >= by_key.size()) {
+                    continue;
+                }
+                Transmission &sent = log_[by_key[err.ee_data]];
+                if (err.ee_info == SCM_TSTAMP_SCHED) {
+                    sent.sched_ns = times.software;
+                } else if (err.ee_info == SCM_TSTAMP_SND && times.hardware) {
+                    sent.nic_ns = times.hardware;
+                } else if (err.ee_info == SCM_TSTAMP_SND) {
+                    sent.driver_ns = times.software;
+                }
+            }
+        }
+    }
+
+    // Write the log out and say where the time went; the sockets are still
+    // open, and bound by now
+    void report() {
+        map<int, int> ports;
+        for (auto &entry : by_key_) {
+            collect(entry.first);
+            struct sockaddr_in local;
+            socklen_t len = sizeof(local);
+            getsockname(entry.first, (struct sockaddr *)&local, &len);
+            ports[entry.first] = ntohs(local.sin_port);
+        }
+        ofstream out(path_);
+        out << "port,seq,type,attempt,path,send_ns,sched_ns,driver_ns,nic_ns,ack_kernel_ns,ack_read_ns\n";
+        vector<int64_t> to_qdisc, to_driver, kernel_rtt, ack_wait;
+        int64_t min_rtt = 0;
+        size_t stamped = 0, nic_stamped = 0;
+        for (const Transmission &sent : log_) {
+            out << ports[sent.sockfd] << ',' << sent.seq << ',' << sent.type << ',' << sent.attempt << ',' << sent.path << ',' << sent.send_ns << ','
+                << sent.sched_ns << ',' << sent.driver_ns << ',' << sent.nic_ns << ',' << sent.ack_kernel_ns << ',' << sent.ack_read_ns
+                << '\n';
+            stamped += sent.driver_ns != 0;
+            nic_stamped += sent.nic_ns != 0;
+            if (sent.sched_ns) {
+                to_qdisc.push_back(sent.sched_ns - sent.send_ns);
+            }
+            if (sent.sched_ns && sent.driver_ns) {
+                to_driver.push_back(sent.driver_ns - sent.sched_ns);
+            }
+            // Karn: only an ACK of a frame sent once says which copy it answers
+            if (sent.attempt == 0 && sent.driver_ns && sent.ack_kernel_ns) {
+                int64_t rtt = sent.ack_kernel_ns - sent.driver_ns;
+                kernel_rtt.push_back(rtt);
+                min_rtt = min_rtt && min_rtt < rtt ? min_rtt : rtt;
+            }
+            if (sent.ack_kernel_ns) {
+                ack_wait.push_back(sent.ack_read_ns - sent.ack_kernel_ns);
+            }
+        }
+        cout << "Trace: " << log_.size() << " transmissions, " << stamped << " with kernel and " << nic_stamped << " with NIC timestamps, in "
+             << path_ << endl;
+        report_spread("send call to qdisc", to_qdisc);
+        report_spread("qdisc to driver", to_driver);
+        report_spread("driver to ACK in kernel", kernel_rtt);
+        report_spread("ACK waiting in socket", ack_wait);
+        if (min_rtt > 0) {
+            cout << "  one-way delay about " << min_rtt / 2000.0 << " us (half the fastest kernel round trip; join with the receiver's "
+                 << "trace for the real thing when clocks are synchronized)" << endl;
+        }
+    }
+
+private:
+    struct Transmission {
+        int sockfd = -1;
+        int type = 0;
+        int seq = 0;
+        int attempt = 0;  // 0 for the first copy
+        int path = 0;
+        int64_t send_ns = 0;  // The rest are 0 until known
+        int64_t sched_ns = 0;
+        int64_t driver_ns = 0;
+        int64_t nic_ns = 0;
+        int64_t ack_kernel_ns = 0;
+        int64_t ack_read_ns = 0;
+    };
+
+    string path_;
+    vector<Transmission> log_;
+    map<int, vector<size_t>> by_key_;  // Log entry of each of a socket's datagrams, by timestamp key
+    map<pair<int, int>, size_t> latest_;  // Latest transmission of a (socket, seq_num)
+};
+
+// Datagram I/O of the network thread. The classic path uses sendto() and
+// non-blocking recvfrom(). With an io_uring, sends are queued as SENDMSG
+// requests and flushed once per event loop iteration, and ACKs land in
+// RECVMSG requests that are always kept posted, so a whole window burst
+// costs one io_uring_enter() (none under SQPOLL).
+class NetPath {
+public:
+    NetPath(int sockfd, const vector<struct sockaddr_in> &recv_addrs, IoUring *ring, PacketTrace *trace)
+        : sockfd_(sockfd), recv_addrs_(recv_addrs), ring_(ring), trace_(trace), completions_(true) {
+        if (!ring_) {
+            return;
+        }
+        if (!ring_->register_files(&sockfd_, 1) || !ring_->register_eventfd(completions_.fd())) {
+            perror("Failed to set up network ring");
+            exit(1);
+        }
+        send_slots_.resize(ring_->cq_entries() / 2);
+        for (size_t i = 0; i < send_slots_.size(); i++) {
+            free_sends_.push_back(i);
+        }
+        for (int i = 0; i < ACK_SLOTS; i++) {
+            post_receive(i);
+        }
+    }
+
+    ~NetPath() {
+        if (ring_) {
+            // Let queued sends leave before the socket closes
+            while (free_sends_.size() < send_slots_.size()) {
+                ring_->submit(1);
+                reap();
+            }
+        }
+    }
+
+    // Readable when ACKs may be waiting
+    int fd() const { return ring_ ? completions_.fd() : sockfd_; }
+
+    // Send over one of the receiver's addresses, all from the same socket
+    void send(const unsigned char *frame, int size, int path = 0) {
+        struct sockaddr_in &recv_addr = recv_addrs_[path];
+        if (trace_) {
+            trace_->sent(sockfd_, frame, path);
+        }
+        if (!ring_) {
+            if (sendto(sockfd_, frame, size, 0, (struct sockaddr *)&recv_addr, sizeof(recv_addr)) < 0) {
+                perror("Failed to send frame");
+                exit(1);
+            }
+            return;
+        }
+        while (free_sends_.empty()) {
+            ring_->submit(1);
+            reap();
+        }
+        int index = free_sends_.back();
+        free_sends_.pop_back();
+        SendSlot &slot = send_slots_[index];
+        memcpy(slot.frame, frame, size);
+        slot.iov.iov_base = slot.frame;
+        slot.iov.iov_len = size;
+        memset(&slot.msg, 0, sizeof(slot.msg));
+        slot.msg.msg_name = &recv_addr;
+        slot.msg.msg_namelen = sizeof(recv_addr);
+        slot.msg.msg_iov = &slot.iov;
+        slot.msg.msg_iovlen = 1;
+        IoUring::prep_sendmsg(ring_->get_sqe(), 0, &slot.msg, SEND_OP | index);
+    }
+
+    // Next ACK without blocking: its size, or -1 once none are pending
+    int receive(unsigned char *ack) {
+        if (!ring_) {
+            struct iovec iov = {ack, ACK_SIZE};
+            char control[TIMESTAMP_CONTROL_SIZE];
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            int ack_size = recvmsg(sockfd_, &msg, MSG_DONTWAIT);
+            if (ack_size < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    if (trace_) {
+                        trace_->collect(sockfd_);
+                    }
+                    return -1;
+                }
+                perror("Failed to receive ACK");
+                exit(1);
+            }
+            if (trace_) {
+                trace_->acked(sockfd_, ack, packet_times(msg));
+            }
+            return ack_size;
+        }
+        if (ready_acks_.empty()) {
+            completions_.wait();
+            reap();
+        }
+        if (ready_acks_.empty()) {
+            if (trace_) {
+                trace_->collect(sockfd_);
+            }
+            return -1;
+        }
+        int index = ready_acks_.front().first;
+        int ack_size = ready_acks_.front().second;
+        ready_acks_.pop_front();
+        memcpy(ack, ack_slots_[index].ack, ack_size);
+        if (trace_) {
+            trace_->acked(sockfd_, ack, packet_times(ack_slots_[index].msg));
+        }
+        post_receive(index);
+        return ack_size;
+    }
+
+    // Hand everything queued so far to the kernel
+    void flush() {
+        if (ring_) {
+            ring_->submit();
+        }
+    }
+
+private:
+    static const uint64_t SEND_OP = 1ULL << 32;
+
+    struct SendSlot {
+        struct msghdr msg;
+        struct iovec iov;
+        unsigned char frame[MAX_FRAME_SIZE];
+    };
+
+    struct AckSlot {
+        struct msghdr msg;
+        struct iovec iov;
+        struct sockaddr_in addr;
+        char control[TIMESTAMP_CONTROL_SIZE];
+        unsigned char ack[ACK_SIZE];
+    };
+
+    void post_receive(int index) {
+        AckSlot &slot = ack_slots_[index];
+        slot.iov.iov_base = slot.ack;
+        slot.iov.iov_len = ACK_SIZE;
+        memset(&slot.msg, 0, sizeof(slot.msg));
+        slot.msg.msg_name = &slot.addr;
+        slot.msg.msg_namelen = sizeof(slot.addr);
+        slot.msg.msg_iov = &slot.iov;
+        slot.msg.msg_iovlen = 1;
+        slot.msg.msg_control = slot.control;
+        slot.msg.msg_controllen = sizeof(slot.control);
+        IoUring::prep_recvmsg(ring_->get_sqe(), 0, &slot.msg, index);
+    }
+
+    void reap() {
+        struct io_uring_cqe *cqe;
+        while ((cqe = ring_->peek_cqe())) {
+            int index = cqe->user_data & 0xFFFFFFFF;
+            if (cqe->res < 0) {
+                errno = -cqe->res;
+                perror(cqe->user_data & SEND_OP ? "Failed to send frame" : "Failed to receive ACK");
+                exit(1);
+            }
+            if (cqe->user_data & SEND_OP) {
+                free_sends_.push_back(index);
+            } else {
+                ready_acks_.push_back(make_pair(index, cqe->res));
+            }
+            ring_->cqe_seen();
+        }
+    }
+
+    int sockfd_;
+    vector<struct sockaddr_in> recv_addrs_;
+    IoUring *ring_;
+    PacketTrace *trace_;
+    QueueSignal completions_;
+    vector<SendSlot> send_slots_;
+    vector<int> free_sends_;
+    AckSlot ack_slots_[ACK_SLOTS];
+    deque<pair<int, int>> ready_acks_;
+};
+
+// Send a zero-length probe so the receiver answers with its current window
+void send_window_probe(NetPath &net, int seq_num, int path, FrameCipher *cipher) {
+    unsigned char probe[MAX_FRAME_SIZE];
+    int probe_size = create_frame(WINDOW_PROBE, seq_num, nullptr, 0, probe, cipher);
+    net.send(probe, probe_size, path);
+    cout << "[window probe] seq_num " << seq_num << endl;
+}
+
+class FileTransfer;
+
+// One socket to a receiver and the sequence space that goes with it. The
+// receiver tells senders apart by source port, so transfers running at the
+// same time each need a channel of their own. A channel is reused by later
+// transfers, its sequence numbers continuing from file to file.
+struct Channel {
+    int sockfd = -1;
+    IoUring ring;  // Network ring, unused on the classic path
+    NetPath *net = nullptr;
+    FrameCipher *cipher = nullptr;  // With a nonce salt of the channel's own
+    int seq_num = 0;
+    FileTransfer *active = nullptr;  // Transfer its ACKs belong to
+
+    ~Channel() {
+        delete cipher;
+        delete net;
+        if (sockfd >= 0) {
+            close(sockfd);
+        }
+    }
+};
+
+// Connection to one receiver that outlives a single transfer. The per-path
+// RTT and loss estimates, congestion window and drop accounting carry over,
+// so later transfers start at the speed the earlier ones reached, and
+// transfers running at the same time share them: cwnd bounds the frames
+// they have in flight together.
+struct Session {
+    vector<struct sockaddr_in> recv_addrs;  // One per path to the receiver
+    vector<Channel *> channels;
+    PathScheduler paths;
+    bool pull = false;  // Send only what the receiver grants
+    bool use_uring = false, sqpoll = false;
+    const unsigned char *key = nullptr;
+    PacketTrace *trace = nullptr;
+    int window = 0;
+    int cwnd = 0;
+    int in_flight = 0;  // Over all of the session's transfers
+    int acked_in_window = 0;
+    uint32_t recv_drops = 0;
+    uint32_t recv_drops_at_loss = 0;
+
+    ~Session() {
+        for (Channel *channel : channels) {
+            delete channel;
+        }
+    }
+};
+
+// receivers: "host:port[,host:port...]", all addresses of the same recvfile.
+// Channels are opened as transfers need them.
+Session *open_session(const string &receivers, int window, bool pull, bool use_uring, bool sqpoll, const unsigned char *key) {
+    Session *session = new Session;
+    session->pull = pull;
+    session->use_uring = use_uring;
+    session->sqpoll = sqpoll;
+    session->key = key;
+    if (key) {
+        cout << "Frames sealed with " << suite_name(preferred_suite()) << endl;
+    }
+    istringstream list(receivers);
+    string receiver;
+    while (getline(list, receiver, ',')) {
+        size_t colon = receiver.rfind(':');
+        session->recv_addrs.push_back(setup_recv_addr(receiver.substr(0, colon), atoi(receiver.c_str() + colon + 1)));
+        session->paths.add(receiver);
+    }
+    session->window = session->cwnd = window;
+    return session;
+}
+
+// With a key every frame is sealed, under a nonce salt of the channel's own
+Channel *open_channel(Session &session) {
+    Channel *channel = new Channel;
+    if (session.key) {
+        channel->cipher = new FrameCipher(session.key, preferred_suite());
+    }
+    channel->sockfd = create_socket(session.window);
+    if (session.trace) {
+        enable_timestamping(channel->sockfd, true);
+    }
+    IoUring *ring = nullptr;
+    if (session.use_uring) {
+        if (channel->ring.setup(URING_ENTRIES, session.sqpoll)) {
+            ring = &channel->ring;
+        } else {
+            perror("io_uring unavailable, using classic network I/O");
+        }
+    }
+    channel->net = new NetPath(channel->sockfd, session.recv_addrs, ring, session.trace);
+    session.channels.push_back(channel);
+    return channel;
+}
+
+// One file on its way over a channel, from the session header to the ACK
+// for End-of-Transfer; ACKs and per-frame timeouts are handled on the event loop
+class FileTransfer {
+public:
+    FileTransfer(EventLoop &loop, Session &session, Channel &channel, const string &filepath, int file_fd, uint64_t file_size,
+                 IoUring *disk_ring, int workers, bool dedup, function<void()> progress)
+        : loop_(loop), session_(session), channel_(channel), paths_(session.paths), file_fd_(file_fd), file_size_(file_size),
+          to_send_(file_size), base_(channel.seq_num), next_seq_num_(channel.seq_num),
+          rwnd_(session.pull ? min(PULL_UNSCHEDULED, session.window) : session.window),  // Until the receiver tells us otherwise
+          recovery_point_(channel.seq_num), workers_(workers), progress_(progress), phase_(dedup ? CHUNKING : SENDING),
+          last_sent_(chrono::steady_clock::now()) {
+        channel.active = this;
+        if (dedup) {
+            chunker_ = thread([this]() {
+                if (!chunk_file(file_fd_, chunks_)) {
+                    perror("Failed to read file");
+                    exit(1);
+                }
+                chunked_.notify();
+            });
+            loop.watch(chunked_.fd(), EPOLLIN, [this](uint32_t) {
+                loop_.unwatch(chunked_.fd());
+                chunker_.join();
+                phase_ = MANIFEST;
+                progress_();
+            });
+        } else {
+            start_data(next_seq_num_ + 1, disk_ring, nullptr);
+        }
+
+        // Nothing in flight and the receiver is full: probe so a lost window
+        // update cannot stall the transfer forever
+        persist_timer_.callback = [this]() {
+            send_window_probe(*channel_.net, next_seq_num_, paths_.best(), channel_.cipher);
+            loop_.arm(persist_timer_, TIMEOUT_MS);
+        };
+
+        int header_seq = next_seq_num_++;
+        Frame &header = track(header_seq);
+        header.size = create_session_frame(header_seq, filepath, file_size, session.window, header.data, channel.cipher);
+        transmit(header_seq, paths_.best());
+        cout << "Session header sent: " << filepath << " (";
+        if (file_size == SessionHeader::unknown_size) {
+            cout << "streamed)" << endl;
+        } else {
+            cout << file_size << " bytes)" << endl;
+        }
+    }
+
+    ~FileTransfer() {
+        loop_.cancel(persist_timer_);
+        for (auto &entry : frame_map_) {
+            loop_.cancel(entry.second.retransmit_timer);
+            delete[] entry.second.data;
+        }
+        session_.in_flight -= next_seq_num_ - base_;
+        if (prep_) {
+            loop_.unwatch(prep_->ready_fd());
+            disk_thread_.join();
+            delete prep_;
+        }
+        channel_.seq_num = next_seq_num_;
+        channel_.active = nullptr;
+    }
+
+    FileTransfer(const FileTransfer &) = delete;
+    FileTransfer &operator=(const FileTransfer &) = delete;
+
+    bool done() const { return eot_seq_ >= 0 && base_ > eot_seq_; }
+    bool rejected() const { return rejected_; }
+    long long bytes_sent() const { return bytes_sent_; }
+    long long zero_bytes() const { return zero_bytes_; }  // Of bytes_sent, those that went as zero ranges
+
+    // Frames still to send, End-of-Transfer included; a stream never runs short
+    uint64_t remaining_frames() const {
+        if (to_send_ == SessionHeader::unknown_size) {
+            return UINT64_MAX;
+        }
+        uint64_t left = to_send_ > (uint64_t)bytes_sent_ ? to_send_ - bytes_sent_ : 0;
+        return (left + MAX_DATA_SIZE - 1) / MAX_DATA_SIZE + 1;
+    }
+
+    // Time since the transfer last sent a fresh frame
+    double waited_ms(chrono::steady_clock::time_point now) const {
+        return chrono::duration<double, milli>(now - last_sent_).count();
+    }
+
+    // A fresh frame is prepared and the windows have room for it
+    bool can_send() {
+        if (send_done_ || next_seq_num_ >= base_ + rwnd_) {
+            return false;
+        }
+        if (!session_.pull && session_.in_flight >= session_.cwnd) {
+            return false;
+        }
+        if (phase_ == MANIFEST) {
+            return true;
+        }
+        return phase_ == SENDING && prepared();
+    }
+
+    // Put the next prepared frame on the wire; only after can_send()
+    void send_next() {
+        if (phase_ == MANIFEST) {
+            send_manifest();
+            return;
+        }
+        int seq = next_seq_num_++;
+        Frame &frame = track(seq);
+        frame.size = block_->frame_sizes[block_frame_];
+        memcpy(frame.data, block_->frames + block_frame_ * MAX_FRAME_SIZE, frame.size);
+        int payload_size = min(MAX_DATA_SIZE, block_->size - block_frame_ * MAX_DATA_SIZE);
+        block_frame_++;
+        transmit(seq, paths_.pick());
+        int probe = paths_.probe(seq);
+        if (probe >= 0) {
+            channel_.net->send(frame.data, frame.size, probe);
+            cout << "[path probe] seq_num " << seq << " on " << paths_[probe].name << endl;
+        }
+
+        if (block_->zeros) {
+            cout << "[send zeros] seq_num " << seq << ", " << block_->zeros << " bytes" << endl;
+            bytes_sent_ += block_->zeros;
+            zero_bytes_ += block_->zeros;
+        } else {
+            cout << "[send data] seq_num " << seq << " sent" << endl;
+            bytes_sent_ += payload_size;
+        }
+        last_sent_ = frame.send_time;
+    }
+
+    void on_ack(unsigned char *ack, int ack_size) {
+        int ack_seq_num, next_expected, window;
+        uint32_t drops;
+        bool error;
+        const unsigned char *needs;
+        int needs_size;
+        if (read_ack(&ack_seq_num, &next_expected, &window, &drops, &error, &needs, &needs_size, ack, ack_size, channel_.cipher) ||
+            (error && (eot_seq_ < 0 || ack_seq_num != eot_seq_))) {
+            cout << "Received corrupt or incorrect ACK" << endl;
+            return;
+        }
+        // An error answering End-of-Transfer ends the transfer all the same,
+        // but the receiver has refused the file
+        rejected_ = rejected_ || error;
+        TRACE_PROBE3(sendfile, ack_receive, ack_seq_num, next_expected, window);
+        cout << "Received ACK for frame " << ack_seq_num << " (next " << next_expected << ", window " << window << ")" << endl;
+        paths_.acked(ack_seq_num);
+        if (next_expected < base_) {
+            return;  // Stale
+        }
+
+        // Only the answer to a query may move past it: an ordinary ACK
+        // that does lets the query time out and be asked again
+        if (query_seq_ >= 0 && ack_seq_num == query_seq_ && needs_size >= (int)(query_count_ + 7) / 8) {
+            for (uint32_t i = 0; i < query_count_; i++) {
+                chunks_[queried_ + i].needed = needs[i / 8] & (0x80 >> (i % 8));
+            }
+            queried_ += query_count_;
+            query_seq_ = -1;
+        } else if (query_seq_ >= 0) {
+            next_expected = min(next_expected, query_seq_);
+        }
+
+        // The acked frame itself may sit above a gap; stop its timer
+        auto it = frame_map_.find(ack_seq_num);
+        if (it != frame_map_.end() && !it->second.acked) {
+            Frame &frame = it->second;
+            if (!frame.retransmitted) {
+                paths_[frame.path].rtt.sample(chrono::duration<double, milli>(chrono::steady_clock::now() - frame.send_time).count());
+            }
+            frame.acked = true;
+            loop_.cancel(frame.retransmit_timer);
+        }
+
+        // Slide the window up to the receiver's cumulative point
+        for (int i = base_; i < next_expected && i < next_seq_num_; i++) {
+            Frame &frame = frame_map_[i];
+            loop_.cancel(frame.retransmit_timer);
+            paths_[frame.path].delivered();
+            delete[] frame.data;
+            frame_map_.erase(i);
+            session_.in_flight--;
+            // Additive increase: one frame per window acked
+            if (++session_.acked_in_window >= session_.cwnd) {
+                session_.acked_in_window = 0;
+                session_.cwnd = min(session_.cwnd + 1, session_.window);
+            }
+        }
+        base_ = min(next_expected, next_seq_num_);
+        rwnd_ = window;
+        session_.recv_drops = max(session_.recv_drops, drops);
+    }
+
+    // After the scheduler has sent what it could: ask about the next chunks
+    // once everything before is acked, keep the persist timer running while
+    // the receiver is full, and end the transfer once the last data frame is
+    // acked
+    void make_progress() {
+        if (phase_ == QUERYING && query_seq_ < 0 && base_ == next_seq_num_) {
+            if (queried_ < chunks_.size()) {
+                send_query();
+            } else {
+                start_sending();
+            }
+        }
+        if (base_ == next_seq_num_ && rwnd_ == 0 && !send_done_) {
+            if (!persist_timer_.armed()) {
+                loop_.arm(persist_timer_, TIMEOUT_MS);
+            }
+        } else {
+            loop_.cancel(persist_timer_);
+        }
+        if (send_done_ && eot_seq_ < 0 && base_ == next_seq_num_) {
+            eot_seq_ = next_seq_num_++;
+            Frame &eot = track(eot_seq_);
+            eot.size = create_frame(END_OF_TRANSFER, eot_seq_, nullptr, 0, eot.data, channel_.cipher);
+            transmit(eot_seq_, paths_.best());
+            cout << "End-of-Transfer packet sent." << endl;
+        }
+    }
+
+private:
+    enum Phase {
+        CHUNKING,  // Waiting for the chunker thread
+        MANIFEST,  // Sending the chunk list
+        QUERYING,  // Asking which chunks the receiver lacks
+        SENDING  // File data, then End-of-Transfer
+    };
+
+    // Disk and prep stages for the data frames from first_seq on: the whole
+    // file, or only the given (offset, length) ranges of it
+    void start_data(int first_seq, IoUring *disk_ring, const vector<pair<uint64_t, uint64_t>> *ranges) {
+        prep_ = new FramePrep(workers_, first_seq, channel_.cipher);
+        if (ranges) {
+            disk_thread_ = thread(read_ahead_ranges, file_fd_, *ranges, ref(*prep_));
+        } else if (disk_ring) {
+            disk_thread_ = thread(read_ahead_uring, ref(*disk_ring), file_fd_, ref(*prep_));
+        } else {
+            disk_thread_ = thread(read_ahead, file_fd_, ref(*prep_));
+        }
+        // The loop calls a copy of the handler, so progress may finish and
+        // delete this transfer
+        function<void()> progress = progress_;
+        loop_.watch(prep_->ready_fd(), EPOLLIN, [this, progress](uint32_t) {
+            prep_->clear_ready();
+            progress();
+        });
+    }
+
+    void send_manifest() {
+        unsigned char data[MAX_DATA_SIZE];
+        int entries = min(chunks_.size() - manifest_sent_, ManifestEntry::per_frame);
+        for (int i = 0; i < entries; i++) {
+            const FileChunk &chunk = chunks_[manifest_sent_ + i];
+            memcpy(data + i * ManifestEntry::size, chunk.hash.bytes, ManifestEntry::hash_size);
+            ManifestEntry::Size::store(data + i * ManifestEntry::size, chunk.size);
+        }
+        int seq = next_seq_num_++;
+        Frame &frame = track(seq);
+        frame.size = create_frame(CHUNK_MANIFEST, seq, data, entries * ManifestEntry::size, frame.data, channel_.cipher);
+        transmit(seq, paths_.pick());
+        manifest_sent_ += entries;
+        if (manifest_sent_ == chunks_.size()) {
+            phase_ = QUERYING;
+        }
+        cout << "[send manifest] seq_num " << seq << ", " << entries << " chunks" << endl;
+    }
+
+    void send_query() {
+        unsigned char data[ChunkQuery::size];
+        query_count_ = min(chunks_.size() - queried_, ChunkQuery::max_count);
+        ChunkQuery::First::store(data, queried_);
+        ChunkQuery::Count::store(data, query_count_);
+        query_seq_ = next_seq_num_++;
+        Frame &frame = track(query_seq_);
+        frame.size = create_frame(CHUNK_QUERY, query_seq_, data, ChunkQuery::size, frame.data, channel_.cipher);
+        transmit(query_seq_, paths_.best());
+        cout << "[send query] seq_num " << query_seq_ << ", chunks " << queried_ << " to " << queried_ + query_count_ - 1 << endl;
+    }
+
+    // Every query is answered: read and send the chunks the receiver lacks,
+    // neighbours merged into one range
+    void start_sending() {
+        vector<pair<uint64_t, uint64_t>> ranges;
+        size_t needed = 0;
+        to_send_ = 0;
+        for (const FileChunk &chunk : chunks_) {
+            if (!chunk.needed) {
+                continue;
+            }
+            needed++;
+            to_send_ += chunk.size;
+            if (!ranges.empty() && ranges.back().first + ranges.back().second == chunk.offset) {
+                ranges.back().second += chunk.size;
+            } else {
+                ranges.push_back(make_pair(chunk.offset, (uint64_t)chunk.size));
+            }
+        }
+        cout << "Dedup: " << chunks_.size() << " chunks, " << needed << " to send, " << to_send_ << " of " << file_size_ << " bytes ("
+             << (file_size_ > 0 ? 100.0 * (file_size_ - to_send_) / file_size_ : 0) << "% saved)" << endl;
+        phase_ = SENDING;
+        start_data(next_seq_num_, nullptr, &ranges);
+    }
+
+    Frame &track(int seq) {
+        Frame &frame = frame_map_[seq];
+        frame.data = new unsigned char[MAX_FRAME_SIZE];
+        frame.retransmit_timer.callback = [this, seq]() { on_timeout(seq); };
+        session_.in_flight++;
+        return frame;
+    }
+
+    void transmit(int seq, int path) {
+        Frame &frame = frame_map_[seq];
+        frame.path = path;
+        TRACE_PROBE3(sendfile, frame_send, seq, frame.size, path);
+        channel_.net->send(frame.data, frame.size, path);
+        paths_[path].sent++;
+        frame.send_time = chrono::steady_clock::now();
+        loop_.arm(frame.retransmit_timer, paths_[path].rtt.rto_ms);
+    }
+
+    // A lost frame counts against its path and goes out again on the best
+    // other one. While a better path exists, lowering the lossy path's
+    // weight moves traffic off it; only losses on the best path are treated
+    // as congestion of the whole session.
+    void on_timeout(int seq) {
+        int lost_path = frame_map_[seq].path;
+        paths_[lost_path].timed_out();
+        if (seq >= recovery_point_) {
+            if (session_.recv_drops > session_.recv_drops_at_loss) {
+                cout << "[loss] receiver overload, its kernel dropped " << session_.recv_drops - session_.recv_drops_at_loss << " frames"
+                     << endl;
+                session_.recv_drops_at_loss = session_.recv_drops;
+            } else if (lost_path != paths_.best()) {
+                cout << "[loss] on " << paths_[lost_path].name << ", shifting traffic to " << paths_[paths_.best()].name << endl;
+            } else {
+                session_.cwnd = max(1, session_.cwnd / 2);
+                session_.acked_in_window = 0;
+                paths_[lost_path].rtt.backoff();
+                cout << "[loss] network loss, cwnd " << session_.cwnd << endl;
+            }
+            recovery_point_ = next_seq_num_;
+        }
+        frame_map_[seq].retransmitted = true;
+        int path = paths_.best(lost_path);
+        TRACE_PROBE2(sendfile, frame_retransmit, seq, path);
+        transmit(seq, path);
+        cout << "[retransmit] seq_num " << seq << " on " << paths_[path].name << endl;
+    }
+
+    // Make the next prepared frame current; false when the prep workers
+    // have not caught up yet or the file is exhausted
+    bool prepared() {
+        while (!block_ || block_frame_ == block_->frame_count) {
+            if (block_ && block_->eof) {
+                send_done_ = true;
+                return false;
+            }
+            if (block_) {
+                prep_->release(block_);
+            }
+            if (!(block_ = prep_->next())) {
+                return false;
+            }
+            block_frame_ = 0;
+        }
+        return true;
+    }
+
+    EventLoop &loop_;
+    Session &session_;
+    Channel &channel_;
+    PathScheduler &paths_;
+    int file_fd_;
+    uint64_t file_size_;
+    uint64_t to_send_;  // Bytes of file data that go out as frames
+    map<int, Frame> frame_map_;
+    int base_;
+    int next_seq_num_;
+    int rwnd_;
+    int recovery_point_;  // React to one loss per window
+    int eot_seq_ = -1;
+    bool rejected_ = false;
+    bool send_done_ = false;
+    long long bytes_sent_ = 0;
+    long long zero_bytes_ = 0;
+    Timer persist_timer_;
+    int workers_;
+    function<void()> progress_;
+    Phase phase_;
+    vector<FileChunk> chunks_;
+    thread chunker_;
+    QueueSignal chunked_;
+    size_t manifest_sent_ = 0;  // Chunks listed so far
+    size_t queried_ = 0;  // Chunks the receiver has answered for
+    int query_seq_ = -1;  // Query awaiting its answer
+    uint32_t query_count_ = 0;
+    FramePrep *prep_ = nullptr;
+    thread disk_thread_;
+    FileBlock *block_ = nullptr;
+    int block_frame_ = 0;
+    chrono::steady_clock::time_point last_sent_;
+};
+
+// CPU time per GB of payload, for comparing I/O paths
+void report_cpu(long long bytes) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+    double sys = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    cout << "CPU " << user << "s user, " << sys << "s sys";
+    if (bytes > 0) {
+        cout << ", " << (user + sys) / (bytes / 1e9) << " s/GB";
+    }
+    cout << endl;
+}
+
+// Frames, losses and RTT of each path, counted over the session's lifetime
+void report_paths(Session &session) {
+    for (int i = 0; i < session.paths.count(); i++) {
+        PathStats &path = session.paths[i];
+        cout << "Path " << path.name << ": " << path.sent << " frames sent, " << path.lost << " lost, srtt "
+             << path.rtt.srtt_ms << " ms, rto " << path.rtt.rto_ms << " ms" << endl;
+    }
+}
+
+// A file waiting for its turn
+struct Job {
+    string receiver;
+    string path;
+    int priority = 0;  // Class, lower goes first
+    uint64_t file_size = 0;
+    long order = 0;  // Of arrival
+    chrono::steady_clock::time_point submitted;
+    chrono::steady_clock::time_point started;
+    int fd = -1;
+    bool disk_ring = false;
+    FileTransfer *transfer = nullptr;
+};
+
+// Runs up to MAX_ACTIVE_TRANSFERS transfers on one event loop and gives
+// each frame's worth of window room to the one that ranks first
+class TransferScheduler {
+public:
+    TransferScheduler(EventLoop &loop, int window, bool pull, bool use_uring, bool sqpoll, IoUring *disk_ring, int workers,
+                      const unsigned char *key, bool srpt, bool dedup, PacketTrace *trace)
+        : loop_(loop), window_(window), pull_(pull), use_uring_(use_uring), sqpoll_(sqpoll), disk_ring_(disk_ring),
+          workers_(workers), key_(key), srpt_(srpt), dedup_(dedup), trace_(trace) {
+        loop_.before_wait([this]() {
+            for (auto &entry : sessions_) {
+                for (Channel *channel : entry.second->channels) {
+                    channel->net->flush();
+                }
+            }
+        });
+    }
+
+    ~TransferScheduler() {
+        for (auto &entry : sessions_) {
+            for (Channel *channel : entry.second->channels) {
+                loop_.unwatch(channel->net->fd());
+            }
+            delete entry.second;
+        }
+    }
+
+    // Queue a file for a receiver, "host:port[,host:port...]"; false when
+    // the file cannot be opened. "-" streams stdin until EOF, its size
+    // unknown until then.
+    bool submit(const string &receiver, const string &path, int priority) {
+        Job job;
+        job.receiver = receiver;
+        job.path = path;
+        job.priority = priority;
+        job.order = submitted_++;
+        job.submitted = chrono::steady_clock::now();
+        if (path == "-") {
+            job.file_size = SessionHeader::unknown_size;
+        } else {
+            struct stat st;
+            if (stat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode)) {
+                cerr << "Error opening file: " << path << endl;
+                failed_++;
+                return false;
+            }
+            job.file_size = st.st_size;
+        }
+        queue_.push_back(job);
+        admit();
+        return true;
+    }
+
+    // No more jobs are coming, stop once the last one is done
+    void close_input() {
+        input_closed_ = true;
+        if (active_.empty() && queue_.empty()) {
+            loop_.stop();
+        }
+    }
+
+    void run() {
+        if (!input_closed_ || !active_.empty() || !queue_.empty()) {
+            loop_.run();
+        }
+    }
+
+    int failed() const { return failed_; }
+    long long bytes_sent() const { return bytes_sent_; }
+
+private:
+    // Lower goes first. The class keeps its rank at least CLASS_SPAN_FRAMES
+    // apart from the next one, and waiting earns AGING_FRAMES_PER_MS, so
+    // anything that waits long enough eventually goes.
+    double rank(const Job &job, uint64_t frames_left, double waited_ms) const {
+        if (!srpt_) {
+            return job.order;
+        }
+        return (double)job.priority * CLASS_SPAN_FRAMES + min<uint64_t>(frames_left, CLASS_SPAN_FRAMES - 1) -
+               waited_ms * AGING_FRAMES_PER_MS;
+    }
+
+    // Start the best queued jobs while there is room
+    void admit() {
+        while (active_.size() < MAX_ACTIVE_TRANSFERS && !queue_.empty()) {
+            auto now = chrono::steady_clock::now();
+            auto best = queue_.begin();
+            for (auto it = queue_.begin(); it != queue_.end(); ++it) {
+                uint64_t frames = it->file_size == SessionHeader::unknown_size ? UINT64_MAX : it->file_size / MAX_DATA_SIZE + 2;
+                uint64_t best_frames = best->file_size == SessionHeader::unknown_size ? UINT64_MAX : best->file_size / MAX_DATA_SIZE + 2;
+                double waited = chrono::duration<double, milli>(now - it->submitted).count();
+                double best_waited = chrono::duration<double, milli>(now - best->submitted).count();
+                if (rank(*it, frames, waited) < rank(*best, best_frames, best_waited)) {
+                    best = it;
+                }
+            }
+            Job job = *best;
+            queue_.erase(best);
+            start(job);
+        }
+    }
+
+    void start(Job &job) {
+        bool streaming = job.path == "-";
+        job.fd = streaming ? STDIN_FILENO : open(job.path.c_str(), O_RDONLY);
+        if (job.fd < 0) {
+            cerr << "Error opening file: " << job.path << endl;
+            cerr << "[failed] " << job.path << endl;
+            failed_++;
+            return;
+        }
+
+        Session *&session = sessions_[job.receiver];
+        if (!session) {
+            session = open_session(job.receiver, window_, pull_, use_uring_, sqpoll_, key_);
+            session->trace = trace_;
+            cout << "Session opened to " << job.receiver << endl;
+        }
+        Channel *channel = nullptr;
+        for (Channel *idle : session->channels) {
+            if (!idle->active) {
+                channel = idle;
+                break;
+            }
+        }
+        if (!channel) {
+            channel = open_channel(*session);
+            loop_.watch(channel->net->fd(), EPOLLIN, [this, channel](uint32_t) {
+                unsigned char ack[ACK_SIZE];
+                int ack_size;
+                while ((ack_size = channel->net->receive(ack)) >= 0) {
+                    if (channel->active) {
+                        channel->active->on_ack(ack, ack_size);
+                    }
+                }
+                pump();
+            });
+        }
+
+        // Only one read-ahead stage at a time can own the disk ring, and a
+        // pipe has no offsets for it anyway. A stream cannot be chunked
+        // before it is sent, and deduplicated data is read range by range.
+        bool dedup = dedup_ && !streaming;
+        job.disk_ring = disk_ring_ && !disk_ring_busy_ && !streaming && !dedup;
+        disk_ring_busy_ = disk_ring_busy_ || job.disk_ring;
+        job.started = chrono::steady_clock::now();
+        job.transfer = new FileTransfer(loop_, *session, *channel, job.path, job.fd, job.file_size,
+                                        job.disk_ring ? disk_ring_ : nullptr, workers_, dedup, [this]() { pump(); });
+        active_.push_back(job);
+    }
+
+    // Hand out send opportunities one frame at a time, then move finished
+    // transfers out of the way and start queued ones in their place
+    void pump() {
+        bool finished;
+        do {
+            auto now = chrono::steady_clock::now();
+            while (true) {
+                Job *next = nullptr;
+                double best = 0;
+                for (Job &job : active_) {
+                    if (!job.transfer->can_send()) {
+                        continue;
+                    }
+                    double r = rank(job, job.transfer->remaining_frames(), job.transfer->waited_ms(now));
+                    if (!next || r < best) {
+                        next = &job;
+                        best = r;
+                    }
+                }
+                if (!next) {
+                    break;
+                }
+                next->transfer->send_next();
+            }
+
+            finished = false;
+            for (size_t i = 0; i < active_.size();) {
+                active_[i].transfer->make_progress();
+                if (!active_[i].transfer->done()) {
+                    i++;
+                    continue;
+                }
+                finish(active_[i]);
+                active_.erase(active_.begin() + i);
+                finished = true;
+            }
+            admit();
+        } while (finished);
+
+        if (input_closed_ && active_.empty() && queue_.empty()) {
+            loop_.stop();
+        }
+    }
+
+    void finish(Job &job) {
+        long long bytes_sent = job.transfer->bytes_sent();
+        long long zero_bytes = job.transfer->zero_bytes();
+        bool rejected = job.transfer->rejected();
+        delete job.transfer;
+        if (job.fd != STDIN_FILENO) {
+            close(job.fd);
+        }
+        if (job.disk_ring) {
+            disk_ring_busy_ = false;
+        }
+        bytes_sent_ += bytes_sent;
+
+        auto now = chrono::steady_clock::now();
+        double elapsed_ms = chrono::duration<double, milli>(now - job.started).count();
+        double completion_ms = chrono::duration<double, milli>(now - job.submitted).count();
+        Session &session = *sessions_[job.receiver];
+        cout << "Transfer took " << elapsed_ms << " ms, goodput " << bytes_sent / elapsed_ms / 1000 << " MB/s" << endl;
+        if (zero_bytes > 0) {
+            cout << "Zero ranges: " << zero_bytes << " of " << bytes_sent << " bytes sent as holes" << endl;
+        }
+        report_paths(session);
+        if (rejected) {
+            cerr << "[failed] " << job.path << ": rejected by " << job.receiver << endl;
+            failed_++;
+            return;
+        }
+        cout << "[completed] " << job.path << " to " << job.receiver << " in " << completion_ms << " ms (cwnd " << session.cwnd << ")"
+             << endl;
+    }
+
+    EventLoop &loop_;
+    int window_;
+    bool pull_;
+    bool use_uring_, sqpoll_;
+    IoUring *disk_ring_;
+    bool disk_ring_busy_ = false;
+    int workers_;
+    const unsigned char *key_;
+    bool srpt_;
+    bool dedup_;
+    PacketTrace *trace_;
+    map<string, Session *> sessions_;
+    vector<Job> active_;
+    deque<Job> queue_;
+    long submitted_ = 0;
+    int failed_ = 0;
+    long long bytes_sent_ = 0;
+    bool input_closed_ = false;
+};
+
+// Daemon mode: one job per line on stdin, "[<recv host>:<recv port>] <path>
+// [<priority class>]", the receiver defaulting to -r. Several comma
+// separated addresses make a multipath session. Jobs are queued as they
+// arrive and run concurrently, reusing the sessions to their receivers.
+int run_daemon(EventLoop &loop, TransferScheduler &scheduler, const string &default_receiver) {
+    auto take_job = [&](const string &line) {
+        istringstream fields(line);
+        vector<string> tokens;
+        string token;
+        while (fields >> token) {
+            tokens.push_back(token);
+        }
+        if (tokens.empty()) {
+            return;
+        }
+        string receiver = default_receiver;
+        if (tokens.size() >= 2 && tokens[0].find(':') != string::npos) {
+            receiver = tokens[0];
+            tokens.erase(tokens.begin());
+        }
+        string file_path = tokens[0];
+        int priority = tokens.size() >= 2 ? atoi(tokens[1].c_str()) : 0;
+        if (receiver.empty() || receiver.rfind(':') == string::npos) {
+            cerr << "[failed] " << file_path << ": no receiver" << endl;
+        } else if (file_path == "-") {
+            cerr << "[failed] -: stdin carries the job list" << endl;
+        } else if (!scheduler.submit(receiver, file_path, priority)) {
+            cerr << "[failed] " << file_path << endl;
+        }
+    };
+
+    // A file of jobs is read at once; pipes and terminals are watched, so
+    // jobs can keep coming while others run
+    struct stat st;
+    if (fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode)) {
+        string line;
+        while (getline(cin, line)) {
+            take_job(line);
+        }
+        scheduler.close_input();
+    } else {
+        string partial;
+        loop.watch(STDIN_FILENO, EPOLLIN, [&](uint32_t) {
+            char buffer[4096];
+            ssize_t n = read(STDIN_FILENO, buffer, sizeof(buffer));
+            if (n <= 0) {
+                loop.unwatch(STDIN_FILENO);
+                take_job(partial);
+                scheduler.close_input();
+                return;
+            }
+            partial.append(buffer, n);
+            size_t newline;
+            while ((newline = partial.find('\n')) != string::npos) {
+                take_job(partial.substr(0, newline));
+                partial.erase(0, newline + 1);
+            }
+        });
+    }
+    scheduler.run();
+    report_cpu(scheduler.bytes_sent());
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    string receivers, subdir, filename;
+    int window = 0;
+    double rate_mbps = 0, rtt_ms = 0;
+    bool use_uring = false, sqpoll = false;
+    int workers = 0;
+    bool daemon = false, pull = false, dedup = false;
+    string policy = "srpt";
+    string key_file, trace_file;
+
+    parse_arguments(argc, argv, receivers, subdir, filename, window, rate_mbps, rtt_ms, use_uring, sqpoll, workers, daemon, pull, policy,
+                    key_file, dedup, trace_file);
+
+    if ((!daemon && (receivers.empty() || filename.empty())) || (policy != "srpt" && policy != "fifo")) {
+        cerr << "Usage: sendfile -r <recv host>:<recv port> [-r ...] -f <subdir>/<filename> | - [-w <window frames>] [-b <Mbit/s> -t <rtt ms>] [-u | -U] [-j <prep workers>] [-d [-S srpt | fifo]] [-P] [-K <key file>] [-D] [-T <trace file>]" << endl;
+        return 1;
+    }
+
+    unsigned char key[KEY_SIZE];
+    if (!key_file.empty() && !load_key(key_file.c_str(), key)) {
+        cerr << "Failed to read a " << KEY_SIZE << "-byte hex key from " << key_file << endl;
+        return 1;
+    }
+
+    // An explicit window wins, otherwise cover the configured path's BDP
+    if (window <= 0) {
+        window = WINDOW_SIZE;
+        if (rate_mbps > 0 && rtt_ms > 0) {
+            window = max(window, bdp_frames(rate_mbps, rtt_ms));
+        }
+    }
+
+    // By default one prep worker per core left over by the network and disk threads
+    if (workers <= 0) {
+        workers = max(1, (int)thread::hardware_concurrency() - 2);
+    }
+
+    // The disk thread's ring is shared by all transfers, each channel has its own network ring
+    IoUring disk_ring;
+    if (use_uring && !disk_ring.setup(READ_AHEAD_BLOCKS + workers, sqpoll)) {
+        perror("io_uring unavailable, using classic I/O");
+        use_uring = false;
+    }
+    cout << "I/O path: " << (use_uring ? (sqpoll ? "io_uring (SQPOLL)" : "io_uring") : "classic") << ", " << workers << " prep workers" << endl;
+
+    EventLoop loop;
+    PacketTrace trace(trace_file);
+    TransferScheduler scheduler(loop, window, pull, use_uring, sqpoll, use_uring ? &disk_ring : nullptr, workers,
+                                key_file.empty() ? nullptr : key, policy == "srpt", dedup, trace_file.empty() ? nullptr : &trace);
+    if (daemon) {
+        int status = run_daemon(loop, scheduler, receivers);
+        if (!trace_file.empty()) {
+            trace.report();
+        }
+        return status;
+    }
+
+    string file_path = filename == "-" ? filename : subdir + "/" + filename;
+    scheduler.submit(receivers, file_path, 0);
+    scheduler.close_input();
+    scheduler.run();
+    if (!trace_file.empty()) {
+        trace.report();
+    }
+    if (scheduler.failed() > 0) {
+        return 1;
+    }
+    report_cpu(scheduler.bytes_sent());
+    cout << "[completed]" << endl;
+    return 0;
+}
+
+
+
+// #include <stdio.h>  // 标准输入输出库，用于文件操作和打印消息
+// #include <stdlib.h> // 标准库，包含了`exit()`函数等
+// #include <string.h> // 字符串操作库，用于处理字符串
+// #include <unistd.h> // 提供UNIX系统调用函数，例如`close()`用于关闭文件描述符
+// #include <arpa/inet.h> // 提供与网络地址操作相关的函数和结构体，例如`inet_addr()`
+// #include <sys/socket.h> // 提供创建套接字以及进行网络通信的函数和结构体
+// #include <sys/time.h>
+
+// #define BUF_SIZE 1024
+// #define WINDOW_SIZE 4
+// #define TIMEOUT 5  // 超时时间 (秒)
+// // #define FILENAME "testfile.bin"
+// #define FILENAME "testfile_10MB.bin"
+
+// // 处理程序中的错误。当发生错误时，perror()函数会打印详细的错误信息，
+// // 然后程序会通过exit(1)安全退出。错误处理非常重要，因为它有助于在出错时提供有用的信息。
+// void error_handling(const char *message) {
+//     perror(message);
+//     exit(1);
+// }
+
+
+// int main(int argc, char *argv[]) {
+//     int sock;
+//     struct sockaddr_in recv_addr;
+//     FILE *fp;
+//     char buffer[BUF_SIZE];
+//     int bytes_read, sent_bytes, ack_num;
+//     int base = 0, next_seq_num = 0;
+//     socklen_t addr_len;
+//     struct timeval tv;
+//     fd_set reads, temp;
+//     long file_size;
+
+//     // 检查命令行参数
+//     // argv[1]：接收端的IP地址。
+//     // argv[2]：接收端的端口号。
+//     // 如果参数不对就退出
+//     if (argc != 3) {
+//         printf("Usage: %s <Receiver IP> <Receiver Port>\n", argv[0]);
+//         exit(1);
+//     }
+
+//     // 创建UDP套接字
+//     // PF_INET：表示IPv4协议。
+//     // SOCK_DGRAM：表示使用UDP协议进行数据报通信。
+//     // 0：协议号，设置为0表示自动选择UDP协议。
+//     // 如果套接字创建失败，程序会调用error_handling()进行错误处理并退出。
+//     sock = socket(PF_INET, SOCK_DGRAM, 0);
+//     if (sock == -1) {
+//         error_handling("socket() error");
+//     }
+
+//     memset(&recv_addr, 0, sizeof(recv_addr));
+//     recv_addr.sin_family = AF_INET; // 使用IPv4地址族
+//     recv_addr.sin_addr.s_addr = inet_addr(argv[1]); // 接收端IP地址
+//     recv_addr.sin_port = htons(atoi(argv[2])); // 接收端端口号 (需要更改)
+
+//     // 打开文件
+//     fp = fopen(FILENAME, "rb");
+//     if (fp == NULL) {
+//         error_handling("fopen() error");
+//     }
+
+//     // 获取文件大小
+//     fseek(fp, 0, SEEK_END);
+//     file_size = ftell(fp);
+//     rewind(fp);
+//     printf("File size: %ld bytes\n", file_size);
+
+//     // 发送文件大小到接收端
+//     file_size = htonl(file_size);
+//     sendto(sock, &file_size, sizeof(file_size), 0, (struct sockaddr*)&recv_addr, sizeof(recv_addr));
+
+//     FD_ZERO(&reads);
+//     FD_SET(sock, &reads);
+//     tv.tv_sec = TIMEOUT;
+//     tv.tv_usec = 0;
+
+//     while (1) {
+//         // 发送窗口内的数据包
+//         while (next_seq_num < base + WINDOW_SIZE && (bytes_read = fread(buffer + sizeof(int), 1, BUF_SIZE - sizeof(int), fp)) > 0) {
+//             // 将序列号封装到数据包前
+//             int network_seq_num = htonl(next_seq_num);
+//             memcpy(buffer, &network_seq_num, sizeof(network_seq_num));
+
+//             printf("Sending packet %d\n", next_seq_num);
+//             sent_bytes = sendto(sock, buffer, bytes_read + sizeof(int), 0, (struct sockaddr*)&recv_addr, sizeof(recv_addr));
+//             if (sent_bytes == -1) {
+//                 error_handling("sendto() error");
+//             }
+//             next_seq_num++;
+//         }
+
+//         // 等待ACK，使用select设置超时
+//         temp = reads;
+//         if (select(sock + 1, &temp, 0, 0, &tv) == -1) {
+//             error_handling("select() error");
+//         }
+
+//         if (FD_ISSET(sock, &temp)) {
+//             addr_len = sizeof(recv_addr);
+//             if (recvfrom(sock, &ack_num, sizeof(ack_num), 0, (struct sockaddr*)&recv_addr, &addr_len) > 0) {
+//                 ack_num = ntohl(ack_num);  // 将网络字节序转换回主机字节序
+//                 printf("Received ACK for packet %d\n", ack_num);
+//                 base = ack_num + 1;  // 滑动窗口
+//             }
+//         } else {
+//             // 超时重传窗口中的数据包
+//             printf("Timeout, resending window from packet %d\n", base);
+//             fseek(fp, base * (BUF_SIZE - sizeof(int)), SEEK_SET);  // 重置文件指针
+//             next_seq_num = base;
+//         }
+
+//         // 如果所有数据包已确认，退出
+//         if (feof(fp) && base == next_seq_num) {
+//             break;
+//         }
+//     }
+
+//     // 发送结束信号
+//     int end_signal = -1;  // 使用特殊序列号标识结束信号
+//     end_signal = htonl(end_signal);
+//     sendto(sock, &end_signal, sizeof(end_signal), 0, (struct sockaddr*)&recv_addr, sizeof(recv_addr));
+//     printf("Sent end signal\n");
+
+//     fclose(fp);
+//     close(sock);
+//     printf("[completed] File transfer completed.\n");
+//     return 0;
+// }
+
+
+
+// #include <stdio.h>         // 标准输入输出库，用于文件操作和打印消息
+// #include <stdlib.h>        
+// #include <string.h>        // 字符串操作库，用于处理字符串
+// #include <unistd.h>        // 提供UNIX系统调用函数，例如`close()`用于关闭文件描述符
+// #include <arpa/inet.h>     // 提供与网络地址操作相关的函数和结构体，例如`inet_addr()`
+// #include <sys/socket.h>    // 提供创建套接字以及进行网络通信的函数和结构体
+
+// #define BUF_SIZE 1024  // 定义每个数据包的大小
+// // #define FILENAME "testfile.txt"  // 假设我们传输的文件名为testfile.txt
+// #define FILENAME "testfile.bin"
+// #define END_SIGNAL "END"  // 结束信号
+
+// // 处理程序中的错误。当发生错误时，perror()函数会打印详细的错误信息，
+// // 然后程序会通过exit(1)安全退出。错误处理非常重要，因为它有助于在出错时提供有用的信息。
+// void error_handling(const char *message) {
+//     perror(message);       // 打印系统错误信息
+//     exit(1);               // 退出程序，错误码为1
+// }
+
+// int main(int argc, char *argv[]) {
+//     // sock：表示套接字的文件描述符，用于网络通信。
+//     // recv_addr：存储接收端的IP地址和端口信息。
+//     // fp：文件指针，用于读取要发送的文件。
+//     // buffer[]：数据缓冲区，用于存储每次从文件中读取的内容。
+//     // bytes_read 和 sent_bytes：分别表示读取的字节数和发送的字节数。
+//     int sock;
+//     struct sockaddr_in recv_addr;
+//     FILE *fp;
+//     char buffer[BUF_SIZE];
+//     int bytes_read, sent_bytes;
+    
+//     // 检查命令行参数
+//     // argv[1]：接收端的IP地址。
+//     // argv[2]：接收端的端口号。
+//     // 如果参数不对就退出
+//     if (argc != 3) {
+//         printf("Usage: %s <Receiver IP> <Receiver Port>\n", argv[0]);
+//         exit(1);
+//     }
+    
+//     // 创建UDP套接字
+//     // PF_INET：表示IPv4协议。
+//     // SOCK_DGRAM：表示使用UDP协议进行数据报通信。
+//     // 0：协议号，设置为0表示自动选择UDP协议。
+//     // 如果套接字创建失败，程序会调用error_handling()进行错误处理并退出。
+//     sock = socket(PF_INET, SOCK_DGRAM, 0);
+//     if (sock == -1) {
+//         error_handling("socket() error");
+//     }
+
+//     // 配置接收端的地址信息
+//     memset(&recv_addr, 0, sizeof(recv_addr));
+//     recv_addr.sin_family = AF_INET; // 使用IPv4地址族
+//     recv_addr.sin_addr.s_addr = inet_addr(argv[1]);  // 接收端IP地址
+//     recv_addr.sin_port = htons(atoi(argv[2]));  // 接收端端口号
+
+//     // 打开要发送的文件，rb模式表示以二进制只读方式打开文件。如果文件不存在或无法打开，程序会报错并退出。
+//     fp = fopen(FILENAME, "rb");
+//     if (fp == NULL) {
+//         error_handling("fopen() error");
+//     } else {
+//         fseek(fp, 0, SEEK_END);   // 移动到文件末尾
+//         long file_size = ftell(fp);  // 获取文件大小
+//         rewind(fp);  // 重置文件指针
+//         printf("File opened successfully, size: %ld bytes\n", file_size);
+//     }
+
+//     // 读取文件并通过UDP发送
+//     // 从文件中读取数据并通过UDP发送：
+//     // fread(buffer, 1, BUF_SIZE, fp)：每次从文件读取BUF_SIZE字节的数据（即1024字节），并存储到缓冲区buffer中。
+//     // sendto(sock, buffer, bytes_read, 0, (struct sockaddr*)&recv_addr, sizeof(recv_addr))：使用sendto()函数通过UDP发送读取到的字节数据。
+//     // sock：UDP套接字。
+//     // buffer：要发送的数据。
+//     // bytes_read：读取到的数据长度。
+//     // (struct sockaddr*)&recv_addr：接收端的地址信息。
+//     while ((bytes_read = fread(buffer, 1, BUF_SIZE, fp)) > 0) {
+//         printf("Bytes read from file: %zu\n", bytes_read);  // 调试输出
+//         // 可选：打印缓冲区前10个字节的内容（十六进制）
+//         printf("Buffer content: ");
+//         for(int i = 0; i < bytes_read && i < 10; i++) {
+//             printf("%02x ", (unsigned char)buffer[i]);
+//         }
+//         printf("\n");
+
+//         sent_bytes = sendto(sock, buffer, bytes_read, 0, (struct sockaddr*)&recv_addr, sizeof(recv_addr));
+//         if (sent_bytes != bytes_read) {
+//             error_handling("sendto() error");
+//         }
+//         printf("[send data] %zu bytes sent\n", sent_bytes);
+//     }
+//     // 在文件发送完毕后，发送一个结束信号
+//     sent_bytes = sendto(sock, END_SIGNAL, strlen(END_SIGNAL), 0, (struct sockaddr*)&recv_addr, sizeof(recv_addr));
+//     if (sent_bytes != strlen(END_SIGNAL)) {
+//         error_handling("sendto() error");
+//     }
+//     printf("[send data] End signal sent\n");
+
+
+//     // 文件发送完毕后，关闭文件和套接字
+//     fclose(fp);
+//     close(sock);
+//     printf("[completed] File transfer completed.\n");
+    
+//     return 0;
+// }
+
@@ -8,15 +8,33 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <fstream>
+#include <map>
+#include <string>
+#include "frame_codec.h"
 
-#define PORT     8080
-#define MAXLINE  1024
+#define PORT        18020
+#define WINDOW_SIZE 5
+#define LINGER_SEC  3   // Keep answering EOF retransmissions this long
 
 using namespace std;
 
+// Reply to a packet: ack_num 1 acknowledges it, 2 asks for a resend
+void sendAck(int sockfd, uint16_t seq, uint16_t ack_num, struct sockaddr_in& cliaddr, socklen_t len) {
+    unsigned char ack[Packet::max_size];
+    FrameWriter<Packet> writer(ack);
+    writer.set<Packet::Seq>(seq);
+    writer.set<Packet::Ack>(ack_num);
+    int size = writer.finish(0);
+    if (sendto(sockfd, ack, size, 0, (const struct sockaddr *) &cliaddr, len) < 0) {
+        perror("sendto failed");
+    }
+}
+
 void receiveFile(int sockfd, struct sockaddr_in& cliaddr) {
-    char buffer[MAXLINE];
+    unsigned char buffer[Packet::max_size];
     socklen_t len = sizeof(cliaddr);
+    map<int, string> pending;  // Out-of-order payloads inside the window
+    int expected = 0;
 
     // Open the file to save received data
     ofstream outFile("received_file.txt", ios::binary);
@@ -26,23 +44,67 @@ void receiveFile(int sockfd, struct sockaddr_in& cliaddr) {
     }
 
     while (true) {
-        // Receive chunks from the client
-        int n = recvfrom(sockfd, buffer, MAXLINE, 0, (struct sockaddr *) &cliaddr, &len);
-        buffer[n] = '\0'; // Null-terminate the received data
-
-        // Check if the received data is the termination message
-        if (strcmp(buffer, "END_OF_FILE") == 0) {
-            cout << "File transfer completed." << endl;
-            break;
+        // Receive packets from the client
+        len = sizeof(cliaddr);
+        int n = recvfrom(sockfd, buffer, sizeof(buffer), 0, (struct sockaddr *) &cliaddr, &len);
+        if (n < 0) {
+            perror("recvfrom failed");
+            exit(EXIT_FAILURE);
+        }
+
+        FrameReader<Packet> packet(buffer, n);
+        if (packet.status() == FRAME_CORRUPT) {
+            cout << "Received corrupted packet" << endl;
+            sendAck(sockfd, packet.get<Packet::Seq>(), 2, cliaddr, len);
+            continue;
+        } else if (!packet.ok()) {
+            continue;
+        }
+
+        // The wire carries 16 bits of seq; widen relative to expected
+        int seq = expected + (int16_t)(packet.get<Packet::Seq>() - (uint16_t)expected);
+        if (packet.payload_size() == 0) {
+            // Check if this is the end-of-file packet
+            if (seq == expected) {
+                sendAck(sockfd, seq, 1, cliaddr, len);
+                cout << "File transfer completed." << endl;
+                break;
+            }
+            continue;
+        }
+        if (seq >= expected + WINDOW_SIZE) {
+            continue;  // Beyond the window, the client will resend it
         }
 
-        // Write the received data to the file
-        outFile.write(buffer, n);
-        cout << "Received " << n << " bytes." << endl;
+        if (seq == expected) {
+            // Write the received data to the file, then whatever it unblocks
+            outFile.write((const char *) packet.payload(), packet.payload_size());
+            cout << "Received " << packet.payload_size() << " bytes." << endl;
+            expected++;
+            while (pending.count(expected)) {
+                outFile.write(pending[expected].data(), pending[expected].size());
+                pending.erase(expected);
+                expected++;
+            }
+        } else if (seq > expected) {
+            pending[seq].assign((const char *) packet.payload(), packet.payload_size());
+        }
+        sendAck(sockfd, seq, 1, cliaddr, len);
     }
 
     // Close the file
     outFile.close();
+
+    // Our EOF ACK may be lost; answer retransmissions until the client goes quiet
+    struct timeval linger = {LINGER_SEC, 0};
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &linger, sizeof(linger));
+    int n;
+    while ((n = recvfrom(sockfd, buffer, sizeof(buffer), 0, (struct sockaddr *) &cliaddr, &len)) >= 0) {
+        FrameReader<Packet> packet(buffer, n);
+        if (packet.ok() && packet.payload_size() == 0) {
+            sendAck(sockfd, packet.get<Packet::Seq>(), 1, cliaddr, len);
+        }
+    }
 }
 
 int main() {
@@ -0,0 +1,151 @@
+// spsc_queue.h
+// Bounded lock-free single-producer/single-consumer ring, plus an eventfd
+// based signal so either side can sleep (or sit in epoll) while the ring is
+// empty or full instead of spinning.
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define CACHE_LINE 64
+
+template <typename T>
+class SpscQueue {
+public:
+    // Capacity is rounded up to a power of two
+    explicit SpscQueue(size_t capacity) : head_(0), tail_(0) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask_ = size - 1;
+        slots_ = new T[size];
+    }
+
+    ~SpscQueue() { delete[] slots_; }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    // Producer side; false when full
+    bool push(const T &item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) > mask_) {
+            return false;
+        }
+        slots_[tail & mask_] = item;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side; false when empty
+    bool pop(T &item) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = slots_[head & mask_];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Approximate when called concurrently, exact from a quiescent side
+    size_t size() const {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+
+private:
+    alignas(CACHE_LINE) std::atomic<size_t> head_;
+    alignas(CACHE_LINE) std::atomic<size_t> tail_;
+    alignas(CACHE_LINE) T *slots_;
+    size_t mask_;
+};
+
+// Wake-up channel between the two ends of a queue
+class QueueSignal {
+public:
+    explicit QueueSignal(bool nonblocking = false) {
+        fd_ = eventfd(0, EFD_CLOEXEC | (nonblocking ? EFD_NONBLOCK : 0));
+        if (fd_ < 0) {
+            perror("eventfd creation failed");
+            exit(1);
+        }
+    }
+
+    ~QueueSignal() { close(fd_); }
+
+    QueueSignal(const QueueSignal &) = delete;
+    QueueSignal &operator=(const QueueSignal &) = delete;
+
+    void notify() {
+        uint64_t one = 1;
+        if (write(fd_, &one, sizeof(one)) < 0) {
+            perror("eventfd write failed");
+        }
+    }
+
+    // Block until notified at least once since the last wait (a
+    // non-blocking signal just resets)
+    void wait() {
+        uint64_t count;
+        if (read(fd_, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+            perror("eventfd read failed");
+        }
+    }
+
+    int fd() const { return fd_; }
+
+private:
+    int fd_;
+};
+
+// Fixed pool of buffers circulating between two threads: the producer fills
+// free buffers and pushes them to ready, the consumer drains ready buffers
+// and hands them back through free.
+template <typename T>
+struct BufferPipe {
+    SpscQueue<T *> ready;
+    SpscQueue<T *> free;
+    QueueSignal ready_signal;
+    QueueSignal free_signal;
+
+    explicit BufferPipe(size_t count) : ready(count), free(count) {}
+
+    // Never full: the pool is no larger than either ring
+    void put_ready(T *item) {
+        ready.push(item);
+        ready_signal.notify();
+    }
+
+    void put_free(T *item) {
+        free.push(item);
+        free_signal.notify();
+    }
+
+    // Blocking takes, for the side that has nothing else to do
+    T *take_ready() {
+        T *item;
+        while (!ready.pop(item)) {
+            ready_signal.wait();
+        }
+        return item;
+    }
+
+    T *take_free() {
+        T *item;
+        while (!free.pop(item)) {
+            free_signal.wait();
+        }
+        return item;
+    }
+};
+
+#endif
@@ -0,0 +1,146 @@
+// timer_wheel.h
+// Hierarchical timing wheel: 4 levels of 64 slots, one tick per slot on the
+// lowest level. Arming, cancelling and expiring a timer are O(1); timers far
+// in the future sit on a coarser level and are cascaded down as time passes.
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <cstdint>
+#include <functional>
+
+#define WHEEL_LEVELS 4
+#define WHEEL_SLOT_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_SLOT_BITS)
+#define WHEEL_MAX_TICKS ((1ULL << (WHEEL_LEVELS * WHEEL_SLOT_BITS)) - 1)
+
+// Timer node, embedded in whatever owns the deadline
+struct Timer {
+    Timer *prev = nullptr;
+    Timer *next = nullptr;
+    uint64_t expires = 0;  // Absolute tick
+    std::function<void()> callback;
+
+    bool armed() const { return next != nullptr; }
+};
+
+class TimerWheel {
+public:
+    explicit TimerWheel(uint64_t now = 0) : now_(now), count_(0) {
+        for (int level = 0; level < WHEEL_LEVELS; level++) {
+            for (int slot = 0; slot < WHEEL_SLOTS; slot++) {
+                Timer &head = slots_[level][slot];
+                head.prev = head.next = &head;
+            }
+        }
+    }
+
+    TimerWheel(const TimerWheel &) = delete;
+    TimerWheel &operator=(const TimerWheel &) = delete;
+
+    uint64_t now() const { return now_; }
+    bool empty() const { return count_ == 0; }
+    int size() const { return count_; }
+
+    // Fire at the given absolute tick (at the next tick if already due)
+    void arm(Timer *t, uint64_t expires) {
+        cancel(t);
+        t->expires = expires;
+        place(t);
+        count_++;
+    }
+
+    void cancel(Timer *t) {
+        if (t->armed()) {
+            unlink(t);
+            count_--;
+        }
+    }
+
+    // Run every tick up to and including 'to', firing due timers
+    void advance(uint64_t to) {
+        if (count_ == 0) {
+            // Nothing to fire or cascade, jump straight there
+            if (to > now_) {
+                now_ = to;
+            }
+            return;
+        }
+        while (now_ < to) {
+            tick();
+        }
+    }
+
+private:
+    static void unlink(Timer *t) {
+        t->prev->next = t->next;
+        t->next->prev = t->prev;
+        t->prev = t->next = nullptr;
+    }
+
+    static void push(Timer &head, Timer *t) {
+        t->prev = head.prev;
+        t->next = &head;
+        head.prev->next = t;
+        head.prev = t;
+    }
+
+    void place(Timer *t) {
+        if (t->expires <= now_) {
+            t->expires = now_ + 1;
+        } else if (t->expires - now_ > WHEEL_MAX_TICKS) {
+            t->expires = now_ + WHEEL_MAX_TICKS;
+        }
+        uint64_t delta = t->expires - now_;
+        int level = 0;
+        while (level < WHEEL_LEVELS - 1 && delta >= (1ULL << (WHEEL_SLOT_BITS * (level + 1)))) {
+            level++;
+        }
+        int slot = (t->expires >> (WHEEL_SLOT_BITS * level)) & (WHEEL_SLOTS - 1);
+        push(slots_[level][slot], t);
+    }
+
+    // Re-place every timer of a coarse slot; they land on finer levels
+    void cascade(int level) {
+        int slot = (now_ >> (WHEEL_SLOT_BITS * level)) & (WHEEL_SLOTS - 1);
+        Timer &head = slots_[level][slot];
+        while (head.next != &head) {
+            Timer *t = head.next;
+            unlink(t);
+            place(t);
+        }
+    }
+
+    void tick() {
+        now_++;
+        for (int level = 1; level < WHEEL_LEVELS; level++) {
+            if ((now_ & ((1ULL << (WHEEL_SLOT_BITS * level)) - 1)) != 0) {
+                break;
+            }
+            cascade(level);
+        }
+
+        // Detach the due slot first so callbacks can freely re-arm
+        Timer &head = slots_[0][now_ & (WHEEL_SLOTS - 1)];
+        Timer due;
+        due.prev = due.next = &due;
+        if (head.next != &head) {
+            due.next = head.next;
+            due.prev = head.prev;
+            due.next->prev = &due;
+            due.prev->next = &due;
+            head.prev = head.next = &head;
+        }
+        while (due.next != &due) {
+            Timer *t = due.next;
+            unlink(t);
+            count_--;
+            t->callback();
+        }
+    }
+
+    Timer slots_[WHEEL_LEVELS][WHEEL_SLOTS];
+    uint64_t now_;
+    int count_;
+};
+
+#endif
@@ -0,0 +1,223 @@
+// uring.h
+// Minimal io_uring wrapper over the raw syscalls (no liburing needed).
+// Submissions are batched: get_sqe() only fills ring slots, submit() makes
+// them visible with a single io_uring_enter() (or none at all under SQPOLL
+// while the kernel thread is awake).
+#ifndef URING_H
+#define URING_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define URING_SQPOLL_IDLE_MS 2000  // SQPOLL thread sleeps after this much idle time
+
+class IoUring {
+public:
+    IoUring() : fd_(-1) {}
+
+    ~IoUring() {
+        if (fd_ >= 0) {
+            munmap(sqes_, sqes_size_);
+            if (cq_ptr_ != sq_ptr_) {
+                munmap(cq_ptr_, cq_size_);
+            }
+            munmap(sq_ptr_, sq_size_);
+            close(fd_);
+        }
+    }
+
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+
+    // False (with errno set) when the kernel or sandbox has no io_uring
+    bool setup(unsigned entries, bool sqpoll) {
+        struct io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        if (sqpoll) {
+            p.flags |= IORING_SETUP_SQPOLL;
+            p.sq_thread_idle = URING_SQPOLL_IDLE_MS;
+        }
+        fd_ = syscall(__NR_io_uring_setup, entries, &p);
+        if (fd_ < 0) {
+            return false;
+        }
+        sqpoll_ = sqpoll;
+
+        sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            sq_size_ = cq_size_ = sq_size_ > cq_size_ ? sq_size_ : cq_size_;
+        }
+        sq_ptr_ = map(sq_size_, IORING_OFF_SQ_RING);
+        cq_ptr_ = single_mmap ? sq_ptr_ : map(cq_size_, IORING_OFF_CQ_RING);
+        sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+        sqes_ = (struct io_uring_sqe *)map(sqes_size_, IORING_OFF_SQES);
+        if (!sq_ptr_ || !cq_ptr_ || !sqes_) {
+            return false;
+        }
+
+        char *sq = (char *)sq_ptr_;
+        sq_head_ = (unsigned *)(sq + p.sq_off.head);
+        sq_tail_ = (unsigned *)(sq + p.sq_off.tail);
+        sq_flags_ = (unsigned *)(sq + p.sq_off.flags);
+        sq_mask_ = *(unsigned *)(sq + p.sq_off.ring_mask);
+        sq_entries_ = p.sq_entries;
+        // SQEs are always handed out in ring order, so the index array is
+        // an identity map filled once
+        unsigned *array = (unsigned *)(sq + p.sq_off.array);
+        for (unsigned i = 0; i < p.sq_entries; i++) {
+            array[i] = i;
+        }
+        sqe_tail_ = *sq_tail_;
+
+        char *cq = (char *)cq_ptr_;
+        cq_head_ = (unsigned *)(cq + p.cq_off.head);
+        cq_tail_ = (unsigned *)(cq + p.cq_off.tail);
+        cq_mask_ = *(unsigned *)(cq + p.cq_off.ring_mask);
+        cq_entries_ = p.cq_entries;
+        cqes_ = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+        return true;
+    }
+
+    unsigned sq_entries() const { return sq_entries_; }
+    unsigned cq_entries() const { return cq_entries_; }
+
+    // Next free submission slot, zeroed; flushes the ring when it is full
+    struct io_uring_sqe *get_sqe() {
+        while (sqe_tail_ - load_acquire(sq_head_) >= sq_entries_) {
+            submit();
+            if (sqpoll_) {
+                sched_yield();
+            }
+        }
+        struct io_uring_sqe *sqe = &sqes_[sqe_tail_ & sq_mask_];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe_tail_++;
+        return sqe;
+    }
+
+    // Publish queued SQEs and optionally wait for completions
+    int submit(unsigned wait_nr = 0) {
+        unsigned to_submit = sqe_tail_ - *sq_tail_;
+        store_release(sq_tail_, sqe_tail_);
+        unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+        if (sqpoll_) {
+            // The tail store must be visible before we look at the flags
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (load_acquire(sq_flags_) & IORING_SQ_NEED_WAKEUP) {
+                flags |= IORING_ENTER_SQ_WAKEUP;
+            } else if (!wait_nr) {
+                return 0;  // Kernel thread is polling, no syscall needed
+            }
+            to_submit = 0;
+        } else if (!to_submit && !wait_nr) {
+            return 0;
+        }
+        int ret;
+        do {
+            ret = syscall(__NR_io_uring_enter, fd_, to_submit, wait_nr, flags, nullptr, 0);
+        } while (ret < 0 && errno == EINTR);
+        return ret;
+    }
+
+    // Completion at the head of the queue, or nullptr
+    struct io_uring_cqe *peek_cqe() {
+        unsigned head = *cq_head_;
+        if (head == load_acquire(cq_tail_)) {
+            return nullptr;
+        }
+        return &cqes_[head & cq_mask_];
+    }
+
+    void cqe_seen() {
+        store_release(cq_head_, *cq_head_ + 1);
+    }
+
+    bool register_buffers(const struct iovec *iovs, unsigned count) {
+        return syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, iovs, count) == 0;
+    }
+
+    bool register_files(const int *fds, unsigned count) {
+        return syscall(__NR_io_uring_register, fd_, IORING_REGISTER_FILES, fds, count) == 0;
+    }
+
+    // Drop registrations so the ring can serve the next file
+    void unregister_buffers() {
+        syscall(__NR_io_uring_register, fd_, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+    }
+
+    void unregister_files() {
+        syscall(__NR_io_uring_register, fd_, IORING_UNREGISTER_FILES, nullptr, 0);
+    }
+
+    // Signal an eventfd on every completion, e.g. to wake an epoll loop
+    bool register_eventfd(int efd) {
+        return syscall(__NR_io_uring_register, fd_, IORING_REGISTER_EVENTFD, &efd, 1) == 0;
+    }
+
+    // Request builders; file is an index into the registered files
+    static void prep_read_fixed(struct io_uring_sqe *sqe, int file, void *buf, unsigned len, uint64_t offset, int buf_index, uint64_t user_data) {
+        prep_rw(sqe, IORING_OP_READ_FIXED, file, buf, len, offset, user_data);
+        sqe->buf_index = buf_index;
+    }
+
+    static void prep_write_fixed(struct io_uring_sqe *sqe, int file, const void *buf, unsigned len, uint64_t offset, int buf_index, uint64_t user_data) {
+        prep_rw(sqe, IORING_OP_WRITE_FIXED, file, buf, len, offset, user_data);
+        sqe->buf_index = buf_index;
+    }
+
+    static void prep_sendmsg(struct io_uring_sqe *sqe, int file, const struct msghdr *msg, uint64_t user_data) {
+        prep_rw(sqe, IORING_OP_SENDMSG, file, msg, 1, 0, user_data);
+    }
+
+    static void prep_recvmsg(struct io_uring_sqe *sqe, int file, struct msghdr *msg, uint64_t user_data) {
+        prep_rw(sqe, IORING_OP_RECVMSG, file, msg, 1, 0, user_data);
+    }
+
+private:
+    static void prep_rw(struct io_uring_sqe *sqe, int op, int file, const void *addr, unsigned len, uint64_t offset, uint64_t user_data) {
+        sqe->opcode = op;
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->fd = file;
+        sqe->addr = (uint64_t)(uintptr_t)addr;
+        sqe->len = len;
+        sqe->off = offset;
+        sqe->user_data = user_data;
+    }
+
+    static unsigned load_acquire(const unsigned *p) {
+        return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+    }
+
+    static void store_release(unsigned *p, unsigned v) {
+        __atomic_store_n(p, v, __ATOMIC_RELEASE);
+    }
+
+    void *map(size_t size, off_t offset) {
+        void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    }
+
+    int fd_;
+    bool sqpoll_ = false;
+    void *sq_ptr_ = nullptr;
+    void *cq_ptr_ = nullptr;
+    size_t sq_size_ = 0, cq_size_ = 0, sqes_size_ = 0;
+    struct io_uring_sqe *sqes_ = nullptr;
+    unsigned *sq_head_, *sq_tail_, *sq_flags_;
+    unsigned sq_mask_ = 0, sq_entries_ = 0;
+    unsigned sqe_tail_ = 0;
+    unsigned *cq_head_, *cq_tail_;
+    unsigned cq_mask_ = 0, cq_entries_ = 0;
+    struct io_uring_cqe *cqes_;
+};
+
+#endif